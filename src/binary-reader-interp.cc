@@ -16,6 +16,7 @@
 
 #include "src/binary-reader-interp.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cinttypes>
 #include <cstdarg>
@@ -50,10 +51,11 @@ Label::Label(IstreamOffset offset, IstreamOffset fixup_offset)
     : offset(offset), fixup_offset(fixup_offset) {}
 
 struct ElemSegmentInfo {
-  ElemSegmentInfo(Index* dst, Index func_index)
-      : dst(dst), func_index(func_index) {}
+  ElemSegmentInfo(Table* table, Index entry_index, Index func_index)
+      : table(table), entry_index(entry_index), func_index(func_index) {}
 
-  Index* dst;
+  Table* table;
+  Index entry_index;
   Index func_index;
 };
 
@@ -148,6 +150,7 @@ class BinaryReaderInterp : public BinaryReaderNop {
   wabt::Result OnAtomicRmwCmpxchgExpr(Opcode opcode,
                                       uint32_t alignment_log2,
                                       Address offset) override;
+  wabt::Result OnOpcode(Opcode opcode) override;
   wabt::Result OnBinaryExpr(wabt::Opcode opcode) override;
   wabt::Result OnBlockExpr(Index num_types, Type* sig_types) override;
   wabt::Result OnBrExpr(Index depth) override;
@@ -230,6 +233,7 @@ class BinaryReaderInterp : public BinaryReaderNop {
   Global* GetGlobalByModuleIndex(Index global_index);
   Type GetGlobalTypeByModuleIndex(Index global_index);
   Index TranslateLocalIndex(Index local_index);
+  Index GetLocalDepth(Index local_index, Index stack_size);
   Type GetLocalTypeByIndex(Func* func, Index local_index);
 
   IstreamOffset GetIstreamOffset();
@@ -239,6 +243,9 @@ class BinaryReaderInterp : public BinaryReaderNop {
                           IstreamOffset size);
   wabt::Result EmitData(const void* data, IstreamOffset size);
   wabt::Result EmitOpcode(Opcode opcode);
+  wabt::Result FuseLastOpcode(Opcode opcode);
+  wabt::Result EmitGetLocal(Index translated_local_index);
+  wabt::Result EmitI32Const(uint32_t value);
   wabt::Result EmitI8(uint8_t value);
   wabt::Result EmitI32(uint32_t value);
   wabt::Result EmitI64(uint64_t value);
@@ -256,6 +263,9 @@ class BinaryReaderInterp : public BinaryReaderNop {
   wabt::Result EmitBrTableOffset(Index depth);
   wabt::Result FixupTopLabel();
   wabt::Result EmitFuncOffset(DefinedFunc* func, Index func_index);
+  wabt::Result EmitPendingOperand(Opcode opcode, uint64_t value);
+  wabt::Result EmitPendingOperands(Index count);
+  wabt::Result EmitRegisterBinop(Opcode opcode);
 
   wabt::Result CheckLocal(Index local_index);
   wabt::Result CheckGlobal(Index global_index);
@@ -289,6 +299,21 @@ class BinaryReaderInterp : public BinaryReaderNop {
   IstreamOffsetVectorVector depth_fixups_;
   MemoryStream istream_;
   IstreamOffset istream_offset_ = 0;
+  // The last instruction emitted, which may be fused with the next one into a
+  // superinstruction. Reset to Invalid wherever the next instruction can be a
+  // branch target.
+  Opcode last_opcode_ = Opcode::Invalid;
+  IstreamOffset last_opcode_offset_ = kInvalidIstreamOffset;
+
+  // With a register istream, the values pushed by get_local and constants are
+  // only emitted once the instruction consuming them is known, so a binary
+  // operator can read locals in place. These are the ones not emitted yet, in
+  // stack order; they are always on top of the stack.
+  struct PendingOperand {
+    Opcode opcode;
+    uint64_t value;  // The local index or the bits of the constant.
+  };
+  std::vector<PendingOperand> pending_operands_;
   /* mappings from module index space to env index space; this won't just be a
    * translation, because imported values will be resolved as well */
   IndexVector sig_index_mapping_;
@@ -404,6 +429,9 @@ wabt::Result BinaryReaderInterp::EmitData(const void* data,
 }
 
 wabt::Result BinaryReaderInterp::EmitOpcode(Opcode opcode) {
+  last_opcode_ = opcode;
+  last_opcode_offset_ = GetIstreamOffset();
+
   if (opcode.HasPrefix()) {
     CHECK_RESULT(EmitI8(opcode.GetPrefix()));
   }
@@ -414,6 +442,33 @@ wabt::Result BinaryReaderInterp::EmitOpcode(Opcode opcode) {
   return EmitI8(code);
 }
 
+// Turns the last instruction emitted into the superinstruction |opcode|. The
+// immediates of the instructions it replaces follow it unchanged.
+wabt::Result BinaryReaderInterp::FuseLastOpcode(Opcode opcode) {
+  assert(!opcode.HasPrefix() && !last_opcode_.HasPrefix());
+  uint8_t code = opcode.GetCode();
+  last_opcode_ = opcode;
+  return EmitDataAt(last_opcode_offset_, &code, sizeof(code));
+}
+
+wabt::Result BinaryReaderInterp::EmitGetLocal(Index translated_local_index) {
+  if (last_opcode_ == Opcode::GetLocal) {
+    CHECK_RESULT(FuseLastOpcode(Opcode::InterpGetLocalGetLocal));
+  } else {
+    CHECK_RESULT(EmitOpcode(Opcode::GetLocal));
+  }
+  return EmitI32(translated_local_index);
+}
+
+wabt::Result BinaryReaderInterp::EmitI32Const(uint32_t value) {
+  if (last_opcode_ == Opcode::GetLocal) {
+    CHECK_RESULT(FuseLastOpcode(Opcode::InterpGetLocalI32Const));
+  } else {
+    CHECK_RESULT(EmitOpcode(Opcode::I32Const));
+  }
+  return EmitI32(value);
+}
+
 wabt::Result BinaryReaderInterp::EmitI8(uint8_t value) {
   return EmitData(&value, sizeof(value));
 }
@@ -535,6 +590,79 @@ wabt::Result BinaryReaderInterp::EmitFuncOffset(DefinedFunc* func,
   return wabt::Result::Ok;
 }
 
+wabt::Result BinaryReaderInterp::EmitPendingOperand(Opcode opcode,
+                                                    uint64_t value) {
+  switch (opcode) {
+    case Opcode::GetLocal:
+      return EmitGetLocal(TranslateLocalIndex(value));
+
+    case Opcode::I32Const:
+      return EmitI32Const(value);
+
+    case Opcode::F32Const:
+      CHECK_RESULT(EmitOpcode(opcode));
+      return EmitI32(value);
+
+    case Opcode::I64Const:
+    case Opcode::F64Const:
+      CHECK_RESULT(EmitOpcode(opcode));
+      return EmitI64(value);
+
+    default:
+      WABT_UNREACHABLE;
+  }
+}
+
+// Emits the |count| deepest pending operands.
+wabt::Result BinaryReaderInterp::EmitPendingOperands(Index count) {
+  assert(count <= pending_operands_.size());
+  for (Index i = 0; i < count; ++i) {
+    const PendingOperand& operand = pending_operands_[i];
+    CHECK_RESULT(EmitPendingOperand(operand.opcode, operand.value));
+  }
+  pending_operands_.erase(pending_operands_.begin(),
+                          pending_operands_.begin() + count);
+  return wabt::Result::Ok;
+}
+
+// Emits a binary operator of a register istream (see IsRegisterBinop). The
+// operands that are locals are read in place, the others are on the stack.
+wabt::Result BinaryReaderInterp::EmitRegisterBinop(Opcode opcode) {
+  Index num_pending = std::min<Index>(pending_operands_.size(), 2);
+  CHECK_RESULT(EmitPendingOperands(pending_operands_.size() - num_pending));
+
+  Index local_indexes[2] = {kInvalidIndex, kInvalidIndex};
+  Index num_locals = 0;
+  Index stack_size = typechecker_.type_stack_size() - num_pending;
+  for (Index i = 0; i < num_pending; ++i) {
+    const PendingOperand& operand = pending_operands_[i];
+    if (operand.opcode == Opcode::GetLocal) {
+      local_indexes[2 - num_pending + i] = operand.value;
+      num_locals++;
+    } else {
+      CHECK_RESULT(EmitPendingOperand(operand.opcode, operand.value));
+      stack_size++;
+    }
+  }
+  pending_operands_.clear();
+
+  Index depths[2];
+  Index stack_depth = 1;
+  for (int i = 1; i >= 0; --i) {
+    depths[i] = local_indexes[i] == kInvalidIndex
+                    ? stack_depth++
+                    : GetLocalDepth(local_indexes[i], stack_size);
+  }
+
+  CHECK_RESULT(typechecker_.OnBinary(opcode));
+  CHECK_RESULT(EmitOpcode(opcode));
+  CHECK_RESULT(EmitI32(depths[0]));
+  CHECK_RESULT(EmitI32(depths[1]));
+  CHECK_RESULT(EmitI32(0));  // Push the result, see OnSetLocalExpr.
+  CHECK_RESULT(EmitI8(2 - num_locals));
+  return wabt::Result::Ok;
+}
+
 bool BinaryReaderInterp::OnError(const char* message) {
   return HandleError(state->offset, message);
 }
@@ -858,7 +986,7 @@ wabt::Result BinaryReaderInterp::OnMemory(Index index,
     PrintError("only one memory allowed");
     return wabt::Result::Error;
   }
-  env_->EmplaceBackMemory(*page_limits);
+  env_->EmplaceBackMemory(*page_limits, env_->guard_page_memory);
   module_->memory_index = env_->GetMemoryCount() - 1;
   return wabt::Result::Ok;
 }
@@ -1017,7 +1145,7 @@ wabt::Result BinaryReaderInterp::OnElemSegmentFunctionIndex(Index index,
     return wabt::Result::Error;
   }
 
-  elem_segment_infos_.emplace_back(&table->func_indexes[table_offset_++],
+  elem_segment_infos_.emplace_back(table, table_offset_++,
                                    TranslateFuncIndexToEnv(func_index));
   return wabt::Result::Ok;
 }
@@ -1073,6 +1201,7 @@ wabt::Result BinaryReaderInterp::BeginFunctionBody(Index index) {
   current_func_ = func;
   depth_fixups_.clear();
   label_stack_.clear();
+  last_opcode_ = Opcode::Invalid;
 
   /* fixup function references */
   Index defined_index = TranslateModuleFuncIndexToDefined(index);
@@ -1099,6 +1228,7 @@ wabt::Result BinaryReaderInterp::EndFunctionBody(Index index) {
   CHECK_RESULT(EmitDropKeep(drop_count, keep_count));
   CHECK_RESULT(EmitOpcode(Opcode::Return));
   PopLabel();
+  current_func_->size = GetIstreamOffset() - current_func_->offset;
   current_func_ = nullptr;
   return wabt::Result::Ok;
 }
@@ -1206,9 +1336,39 @@ wabt::Result BinaryReaderInterp::OnAtomicRmwCmpxchgExpr(Opcode opcode,
   return wabt::Result::Ok;
 }
 
+wabt::Result BinaryReaderInterp::OnOpcode(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::GetLocal:
+    case Opcode::I32Const:
+    case Opcode::I64Const:
+    case Opcode::F32Const:
+    case Opcode::F64Const:
+      break;
+
+    default:
+      if (!IsRegisterBinop(opcode)) {
+        CHECK_RESULT(EmitPendingOperands(pending_operands_.size()));
+      }
+      break;
+  }
+  return wabt::Result::Ok;
+}
+
 wabt::Result BinaryReaderInterp::OnBinaryExpr(wabt::Opcode opcode) {
+  if (env_->register_istream) {
+    return EmitRegisterBinop(opcode);
+  }
+
   CHECK_RESULT(typechecker_.OnBinary(opcode));
-  CHECK_RESULT(EmitOpcode(opcode));
+  if (opcode == Opcode::I32Add &&
+      last_opcode_ == Opcode::InterpGetLocalGetLocal) {
+    CHECK_RESULT(FuseLastOpcode(Opcode::InterpGetLocalGetLocalI32Add));
+  } else if (opcode == Opcode::I32Add &&
+             last_opcode_ == Opcode::InterpGetLocalI32Const) {
+    CHECK_RESULT(FuseLastOpcode(Opcode::InterpGetLocalI32ConstI32Add));
+  } else {
+    CHECK_RESULT(EmitOpcode(opcode));
+  }
   return wabt::Result::Ok;
 }
 
@@ -1222,7 +1382,9 @@ wabt::Result BinaryReaderInterp::OnBlockExpr(Index num_types, Type* sig_types) {
 wabt::Result BinaryReaderInterp::OnLoopExpr(Index num_types, Type* sig_types) {
   TypeVector sig(sig_types, sig_types + num_types);
   CHECK_RESULT(typechecker_.OnLoop(&sig));
+  env_->AddOsrMetadata(current_func_, GetIstreamOffset());
   PushLabel(GetIstreamOffset(), kInvalidIstreamOffset);
+  last_opcode_ = Opcode::Invalid;
   return wabt::Result::Ok;
 }
 
@@ -1257,6 +1419,7 @@ wabt::Result BinaryReaderInterp::OnEndExpr() {
   }
   FixupTopLabel();
   PopLabel();
+  last_opcode_ = Opcode::Invalid;
   return wabt::Result::Ok;
 }
 
@@ -1352,13 +1515,19 @@ wabt::Result BinaryReaderInterp::OnDropExpr() {
 
 wabt::Result BinaryReaderInterp::OnI32ConstExpr(uint32_t value) {
   CHECK_RESULT(typechecker_.OnConst(Type::I32));
-  CHECK_RESULT(EmitOpcode(Opcode::I32Const));
-  CHECK_RESULT(EmitI32(value));
-  return wabt::Result::Ok;
+  if (env_->register_istream) {
+    pending_operands_.push_back({Opcode::I32Const, value});
+    return wabt::Result::Ok;
+  }
+  return EmitI32Const(value);
 }
 
 wabt::Result BinaryReaderInterp::OnI64ConstExpr(uint64_t value) {
   CHECK_RESULT(typechecker_.OnConst(Type::I64));
+  if (env_->register_istream) {
+    pending_operands_.push_back({Opcode::I64Const, value});
+    return wabt::Result::Ok;
+  }
   CHECK_RESULT(EmitOpcode(Opcode::I64Const));
   CHECK_RESULT(EmitI64(value));
   return wabt::Result::Ok;
@@ -1366,6 +1535,10 @@ wabt::Result BinaryReaderInterp::OnI64ConstExpr(uint64_t value) {
 
 wabt::Result BinaryReaderInterp::OnF32ConstExpr(uint32_t value_bits) {
   CHECK_RESULT(typechecker_.OnConst(Type::F32));
+  if (env_->register_istream) {
+    pending_operands_.push_back({Opcode::F32Const, value_bits});
+    return wabt::Result::Ok;
+  }
   CHECK_RESULT(EmitOpcode(Opcode::F32Const));
   CHECK_RESULT(EmitI32(value_bits));
   return wabt::Result::Ok;
@@ -1373,6 +1546,10 @@ wabt::Result BinaryReaderInterp::OnF32ConstExpr(uint32_t value_bits) {
 
 wabt::Result BinaryReaderInterp::OnF64ConstExpr(uint64_t value_bits) {
   CHECK_RESULT(typechecker_.OnConst(Type::F64));
+  if (env_->register_istream) {
+    pending_operands_.push_back({Opcode::F64Const, value_bits});
+    return wabt::Result::Ok;
+  }
   CHECK_RESULT(EmitOpcode(Opcode::F64Const));
   CHECK_RESULT(EmitI64(value_bits));
   return wabt::Result::Ok;
@@ -1401,28 +1578,44 @@ wabt::Result BinaryReaderInterp::OnSetGlobalExpr(Index global_index) {
   return wabt::Result::Ok;
 }
 
+// The offset of a local from the frame base of the function, which is just
+// above its params (see Thread::call_stack_).
 Index BinaryReaderInterp::TranslateLocalIndex(Index local_index) {
-  return typechecker_.type_stack_size() +
-         current_func_->param_and_local_types.size() - local_index;
+  Index num_params =
+      current_func_->param_and_local_types.size() - current_func_->local_count;
+  return local_index - num_params;
+}
+
+// The depth of a local on the stack when it holds |stack_size| values above
+// the locals. Operands of register istreams are depths, as most of them are
+// not locals.
+Index BinaryReaderInterp::GetLocalDepth(Index local_index, Index stack_size) {
+  return stack_size + current_func_->param_and_local_types.size() -
+         local_index;
 }
 
 wabt::Result BinaryReaderInterp::OnGetLocalExpr(Index local_index) {
   CHECK_RESULT(CheckLocal(local_index));
   Type type = GetLocalTypeByIndex(current_func_, local_index);
-  // Get the translated index before calling typechecker_.OnGetLocal because it
-  // will update the type stack size. We need the index to be relative to the
-  // old stack size.
-  Index translated_local_index = TranslateLocalIndex(local_index);
   CHECK_RESULT(typechecker_.OnGetLocal(type));
-  CHECK_RESULT(EmitOpcode(Opcode::GetLocal));
-  CHECK_RESULT(EmitI32(translated_local_index));
-  return wabt::Result::Ok;
+  if (env_->register_istream) {
+    pending_operands_.push_back({Opcode::GetLocal, local_index});
+    return wabt::Result::Ok;
+  }
+  return EmitGetLocal(TranslateLocalIndex(local_index));
 }
 
 wabt::Result BinaryReaderInterp::OnSetLocalExpr(Index local_index) {
   CHECK_RESULT(CheckLocal(local_index));
   Type type = GetLocalTypeByIndex(current_func_, local_index);
   CHECK_RESULT(typechecker_.OnSetLocal(type));
+  if (env_->register_istream && IsRegisterBinop(last_opcode_)) {
+    // Have the binary operator store its result to the local instead.
+    IstreamOffset dest_offset = last_opcode_offset_ + 1 + 2 * sizeof(uint32_t);
+    last_opcode_ = Opcode::Invalid;
+    Index depth = GetLocalDepth(local_index, typechecker_.type_stack_size());
+    return EmitI32At(dest_offset, depth);
+  }
   CHECK_RESULT(EmitOpcode(Opcode::SetLocal));
   CHECK_RESULT(EmitI32(TranslateLocalIndex(local_index)));
   return wabt::Result::Ok;
@@ -1528,7 +1721,13 @@ wabt::Result BinaryReaderInterp::OnWakeExpr(Opcode opcode,
 
 wabt::Result BinaryReaderInterp::EndModule() {
   for (ElemSegmentInfo& info : elem_segment_infos_) {
-    *info.dst = info.func_index;
+    Func* func = env_->GetFunc(info.func_index);
+    info.table->SetEntry(
+        info.entry_index, info.func_index,
+        env_->GetFuncSignature(func->sig_index)->canonical_index);
+  }
+  if (!elem_segment_infos_.empty()) {
+    env_->ClearCallIndirectCaches();
   }
   for (DataSegmentInfo& info : data_segment_infos_) {
     memcpy(info.dst_data, info.src_data, info.size);
@@ -1566,6 +1765,8 @@ wabt::Result ReadBinaryInterp(Environment* env,
                               const ReadBinaryOptions* options,
                               ErrorHandler* error_handler,
                               DefinedModule** out_module) {
+  env->WaitForBackgroundJit();
+
   // Need to mark before taking ownership of env->istream.
   Environment::MarkPoint mark = env->Mark();
 
@@ -168,7 +168,9 @@ namespace {
 
 class BinaryReaderOpcnt : public BinaryReaderNop {
  public:
-  explicit BinaryReaderOpcnt(OpcodeInfoCounts* counts);
+  BinaryReaderOpcnt(OpcodeInfoCounts* counts,
+                    OpcodeSequenceCounts* sequence_counts,
+                    size_t max_sequence_length);
 
   Result OnOpcode(Opcode opcode) override;
   Result OnOpcodeBare() override;
@@ -189,8 +191,14 @@ class BinaryReaderOpcnt : public BinaryReaderNop {
   template <typename... Args>
   Result Emplace(Args&&... args);
 
+  void CountSequences();
+
   OpcodeInfoCounts* opcode_counts_;
+  OpcodeSequenceCounts* sequence_counts_;
+  size_t max_sequence_length_;
   Opcode current_opcode_;
+  // The most recent opcodes of the current function, oldest first.
+  OpcodeSequence recent_opcodes_;
 };
 
 template <typename... Args>
@@ -204,11 +212,31 @@ Result BinaryReaderOpcnt::Emplace(Args&&... args) {
   return Result::Ok;
 }
 
-BinaryReaderOpcnt::BinaryReaderOpcnt(OpcodeInfoCounts* counts)
-    : opcode_counts_(counts) {}
+BinaryReaderOpcnt::BinaryReaderOpcnt(OpcodeInfoCounts* counts,
+                                     OpcodeSequenceCounts* sequence_counts,
+                                     size_t max_sequence_length)
+    : opcode_counts_(counts),
+      sequence_counts_(sequence_counts),
+      max_sequence_length_(max_sequence_length) {}
+
+void BinaryReaderOpcnt::CountSequences() {
+  if (recent_opcodes_.size() > max_sequence_length_) {
+    recent_opcodes_.erase(recent_opcodes_.begin());
+  }
+
+  for (size_t length = 2; length <= recent_opcodes_.size(); ++length) {
+    OpcodeSequence sequence(recent_opcodes_.end() - length,
+                            recent_opcodes_.end());
+    (*sequence_counts_)[sequence]++;
+  }
+}
 
 Result BinaryReaderOpcnt::OnOpcode(Opcode opcode) {
   current_opcode_ = opcode;
+  if (sequence_counts_) {
+    recent_opcodes_.push_back(opcode);
+    CountSequences();
+  }
   return Result::Ok;
 }
 
@@ -259,6 +287,7 @@ Result BinaryReaderOpcnt::OnEndExpr() {
 }
 
 Result BinaryReaderOpcnt::OnEndFunc() {
+  recent_opcodes_.clear();
   return Emplace(Opcode::End, OpcodeInfo::Kind::Bare);
 }
 
@@ -267,8 +296,10 @@ Result BinaryReaderOpcnt::OnEndFunc() {
 Result ReadBinaryOpcnt(const void* data,
                        size_t size,
                        const struct ReadBinaryOptions* options,
-                       OpcodeInfoCounts* counts) {
-  BinaryReaderOpcnt reader(counts);
+                       OpcodeInfoCounts* counts,
+                       OpcodeSequenceCounts* sequence_counts,
+                       size_t max_sequence_length) {
+  BinaryReaderOpcnt reader(counts, sequence_counts, max_sequence_length);
   return ReadBinary(data, size, &reader, options);
 }
 
@@ -83,10 +83,19 @@ bool operator>=(const OpcodeInfo&, const OpcodeInfo&);
 
 typedef std::map<OpcodeInfo, size_t> OpcodeInfoCounts;
 
+// Counts of runs of consecutive opcodes within a function body, ignoring
+// immediates.
+typedef std::vector<Opcode> OpcodeSequence;
+typedef std::map<OpcodeSequence, size_t> OpcodeSequenceCounts;
+
+// If |sequence_counts| is non-null, every run of 2 to |max_sequence_length|
+// consecutive opcodes is counted in it as well.
 Result ReadBinaryOpcnt(const void* data,
                        size_t size,
                        const struct ReadBinaryOptions* options,
-                       OpcodeInfoCounts* opcode_counts);
+                       OpcodeInfoCounts* opcode_counts,
+                       OpcodeSequenceCounts* sequence_counts = nullptr,
+                       size_t max_sequence_length = 0);
 
 }  // namespace wabt
 
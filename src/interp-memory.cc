@@ -0,0 +1,208 @@
+/*
+ * Copyright 2018 wasmjit-omr project participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/interp-memory.h"
+
+#include <cassert>
+#include <utility>
+
+#if WABT_GUARD_PAGE_MEMORY
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <mutex>
+#endif
+
+namespace wabt {
+namespace interp {
+
+#if WABT_GUARD_PAGE_MEMORY
+
+namespace {
+
+// Any access computes its address as a 32-bit index plus a 32-bit offset and
+// touches at most 8 bytes past it, so this covers every address an access can
+// reach.
+const size_t kGuardedReservationSize = (size_t(1) << 33) + (size_t(1) << 16);
+
+// Each guarded memory reserves 8GiB, so this allows reserving half of a 47-bit
+// address space.
+const size_t kMaxReservations = 8192;
+
+// The start addresses of the reservations, or nullptr for free slots. They are
+// read by the signal handler, so they are lock-free atomics rather than a
+// container that may reallocate.
+std::atomic<const char*> s_reservations[kMaxReservations];
+static_assert(ATOMIC_POINTER_LOCK_FREE == 2,
+              "the signal handler needs lock-free atomic pointers");
+
+thread_local GuardPageTrapScope* s_trap_scope = nullptr;
+struct sigaction s_previous_action;
+std::once_flag s_handler_installed;
+
+size_t RoundUpToSystemPage(size_t size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  return (size + page_size - 1) & ~(page_size - 1);
+}
+
+bool AddReservation(const char* begin) {
+  for (auto& reservation : s_reservations) {
+    const char* expected = nullptr;
+    if (reservation.compare_exchange_strong(expected, begin)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void RemoveReservation(const char* begin) {
+  for (auto& reservation : s_reservations) {
+    const char* expected = begin;
+    if (reservation.compare_exchange_strong(expected, nullptr)) {
+      return;
+    }
+  }
+}
+
+bool IsReservedAddress(const void* address) {
+  auto* p = static_cast<const char*>(address);
+  for (const auto& reservation : s_reservations) {
+    const char* begin = reservation.load(std::memory_order_relaxed);
+    if (begin && p >= begin && p < begin + kGuardedReservationSize) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void HandleSegmentationFault(int signal, siginfo_t* info, void* context) {
+  if (s_trap_scope && IsReservedAddress(info->si_addr)) {
+    siglongjmp(*s_trap_scope->jump_buffer(), 1);
+  }
+
+  // Not an out-of-bounds memory access. Restore the previous handler; the
+  // faulting instruction is re-executed and faults again.
+  sigaction(SIGSEGV, &s_previous_action, nullptr);
+}
+
+void InstallSegmentationFaultHandler() {
+  std::call_once(s_handler_installed, []() {
+    struct sigaction action = {};
+    action.sa_sigaction = HandleSegmentationFault;
+    // SA_NODEFER keeps SIGSEGV unblocked after jumping out of the handler, so
+    // the jump buffers don't need to save the signal mask.
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &s_previous_action);
+  });
+}
+
+}  // end anonymous namespace
+
+GuardPageTrapScope::GuardPageTrapScope() : previous_(s_trap_scope) {
+  s_trap_scope = this;
+}
+
+GuardPageTrapScope::~GuardPageTrapScope() {
+  s_trap_scope = previous_;
+}
+
+#endif  // WABT_GUARD_PAGE_MEMORY
+
+MemoryData::MemoryData(size_t size, bool guarded) {
+#if WABT_GUARD_PAGE_MEMORY
+  if (guarded) {
+    void* reservation = mmap(nullptr, kGuardedReservationSize, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reservation != MAP_FAILED) {
+      guarded_data_ = static_cast<char*>(reservation);
+      if (AddReservation(guarded_data_) && resize(size)) {
+        InstallSegmentationFaultHandler();
+        return;
+      }
+      Release();
+    }
+    // Fall back to an unguarded memory if the address space is not available.
+  }
+#endif
+  heap_data_.resize(size);
+  size_ = size;
+}
+
+MemoryData::MemoryData(MemoryData&& other) {
+  *this = std::move(other);
+}
+
+MemoryData& MemoryData::operator=(MemoryData&& other) {
+  if (this != &other) {
+    Release();
+    heap_data_ = std::move(other.heap_data_);
+    guarded_data_ = other.guarded_data_;
+    size_ = other.size_;
+    other.heap_data_.clear();
+    other.guarded_data_ = nullptr;
+    other.size_ = 0;
+  }
+  return *this;
+}
+
+MemoryData::~MemoryData() {
+  Release();
+}
+
+bool MemoryData::resize(size_t size) {
+  if (!guarded()) {
+    heap_data_.resize(size);
+    size_ = size;
+    return true;
+  }
+
+#if WABT_GUARD_PAGE_MEMORY
+  assert(size <= kGuardedReservationSize);
+  size_t old_committed = RoundUpToSystemPage(size_);
+  size_t new_committed = RoundUpToSystemPage(size);
+
+  if (new_committed > old_committed) {
+    if (mprotect(guarded_data_ + old_committed, new_committed - old_committed,
+                 PROT_READ | PROT_WRITE) != 0) {
+      return false;
+    }
+  } else if (new_committed < old_committed) {
+    // Drop the pages so they read as zero if the memory grows again.
+    madvise(guarded_data_ + new_committed, old_committed - new_committed,
+            MADV_DONTNEED);
+    mprotect(guarded_data_ + new_committed, old_committed - new_committed,
+             PROT_NONE);
+  }
+  size_ = size;
+#endif
+  return true;
+}
+
+void MemoryData::Release() {
+#if WABT_GUARD_PAGE_MEMORY
+  if (guarded_data_) {
+    RemoveReservation(guarded_data_);
+    munmap(guarded_data_, kGuardedReservationSize);
+    guarded_data_ = nullptr;
+  }
+#endif
+}
+
+}  // namespace interp
+}  // namespace wabt
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2018 wasmjit-omr project participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef WABT_INTERP_MEMORY_H_
+#define WABT_INTERP_MEMORY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "config.h"
+
+#if HAVE_MMAP && HAVE_SIGSETJMP && SIZEOF_SIZE_T == 8 && defined(__linux__)
+#define WABT_GUARD_PAGE_MEMORY 1
+#else
+#define WABT_GUARD_PAGE_MEMORY 0
+#endif
+
+#if WABT_GUARD_PAGE_MEMORY
+#include <setjmp.h>
+#endif
+
+namespace wabt {
+namespace interp {
+
+// The contents of a linear memory.
+//
+// By default the contents are a plain heap allocation, so every access must be
+// bounds-checked. A guarded MemoryData instead reserves enough address space
+// up-front for any address an access can compute (a 32-bit index plus a 32-bit
+// offset) and only makes the first size() bytes accessible. Out-of-bounds
+// accesses then fault instead of needing an explicit check; see
+// GuardPageTrapScope for how those faults are turned into traps. The address
+// of a guarded memory also never changes when it grows.
+class MemoryData {
+ public:
+  MemoryData() = default;
+  explicit MemoryData(size_t size, bool guarded = false);
+  MemoryData(MemoryData&&);
+  MemoryData& operator=(MemoryData&&);
+  ~MemoryData();
+
+  MemoryData(const MemoryData&) = delete;
+  MemoryData& operator=(const MemoryData&) = delete;
+
+  char* data() { return guarded_data_ ? guarded_data_ : heap_data_.data(); }
+  const char* data() const {
+    return guarded_data_ ? guarded_data_ : heap_data_.data();
+  }
+  size_t size() const { return size_; }
+  bool guarded() const { return guarded_data_ != nullptr; }
+
+  char& operator[](size_t index) { return data()[index]; }
+  const char& operator[](size_t index) const { return data()[index]; }
+
+  // Returns false if the pages of a guarded memory could not be committed, in
+  // which case the memory keeps its previous size.
+  bool resize(size_t size) WABT_WARN_UNUSED;
+
+ private:
+  void Release();
+
+  std::vector<char> heap_data_;
+  char* guarded_data_ = nullptr;
+  size_t size_ = 0;
+};
+
+#if WABT_GUARD_PAGE_MEMORY
+
+// While a GuardPageTrapScope is alive, a fault in the reserved address space of
+// a guarded MemoryData jumps back to the point set with sigsetjmp on
+// jump_buffer(). Code accessing guarded memory must therefore record its
+// Thread::pc_ before the access, so the trap can be reported correctly. Scopes
+// may be nested; the innermost one receives the fault.
+//
+// The jump skips the frames between the one that called sigsetjmp and the
+// faulting access without running any destructors. Those frames must therefore
+// not have locals with non-trivial destructors (see Thread::Run and
+// Thread::CallJITed).
+//
+// Usage:
+//
+//   GuardPageTrapScope scope;
+//   if (sigsetjmp(*scope.jump_buffer(), 0) != 0) {
+//     return Result::TrapMemoryAccessOutOfBounds;
+//   }
+//   ... run code accessing guarded memory ...
+class GuardPageTrapScope {
+ public:
+  GuardPageTrapScope();
+  ~GuardPageTrapScope();
+
+  GuardPageTrapScope(const GuardPageTrapScope&) = delete;
+  GuardPageTrapScope& operator=(const GuardPageTrapScope&) = delete;
+
+  sigjmp_buf* jump_buffer() { return &jump_buffer_; }
+
+ private:
+  sigjmp_buf jump_buffer_;
+  GuardPageTrapScope* previous_;
+};
+
+#endif  // WABT_GUARD_PAGE_MEMORY
+
+}  // namespace interp
+}  // namespace wabt
+
+#endif /* WABT_INTERP_MEMORY_H_ */
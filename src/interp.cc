@@ -21,7 +21,9 @@
 #include <cinttypes>
 #include <cmath>
 #include <limits>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "src/cast.h"
@@ -153,7 +155,12 @@ Thread::Options::Options(uint32_t value_stack_size,
 Thread::Thread(Environment* env, const Options& options)
     : env_(env),
       value_stack_(options.value_stack_size),
-      call_stack_(options.call_stack_size) {}
+      call_stack_(options.call_stack_size),
+      value_stack_data_(value_stack_.data()),
+      value_stack_size_(options.value_stack_size),
+      call_stack_data_(call_stack_.data()),
+      call_stack_size_(options.call_stack_size),
+      cache_top_of_stack_(options.cache_top_of_stack) {}
 
 FuncSignature::FuncSignature(Index param_count,
                              Type* param_types,
@@ -201,6 +208,8 @@ Environment::MarkPoint Environment::Mark() {
 }
 
 void Environment::ResetToMarkPoint(const MarkPoint& mark) {
+  WaitForBackgroundJit();
+
   // Destroy entries in the binding hash.
   for (size_t i = mark.modules_size; i < modules_.size(); ++i) {
     std::string name = modules_[i]->name;
@@ -220,11 +229,53 @@ void Environment::ResetToMarkPoint(const MarkPoint& mark) {
 
   modules_.erase(modules_.begin() + mark.modules_size, modules_.end());
   sigs_.erase(sigs_.begin() + mark.sigs_size, sigs_.end());
+  for (auto iter = canonical_sigs_.begin(); iter != canonical_sigs_.end();) {
+    if (iter->second >= mark.sigs_size)
+      iter = canonical_sigs_.erase(iter);
+    else
+      ++iter;
+  }
   funcs_.erase(funcs_.begin() + mark.funcs_size, funcs_.end());
   memories_.erase(memories_.begin() + mark.memories_size, memories_.end());
   tables_.erase(tables_.begin() + mark.tables_size, tables_.end());
   globals_.erase(globals_.begin() + mark.globals_size, globals_.end());
   istream_->data.resize(mark.istream_size);
+
+  // The JIT metadata of the functions just destroyed refers to them and to
+  // their compiled code. It would be found again by functions loaded later at
+  // the same offsets.
+  for (auto iter = jit_meta_.begin(); iter != jit_meta_.end();) {
+    if (iter->first >= mark.istream_size)
+      iter = jit_meta_.erase(iter);
+    else
+      ++iter;
+  }
+  for (auto iter = osr_meta_.begin(); iter != osr_meta_.end();) {
+    if (iter->first >= mark.istream_size)
+      iter = osr_meta_.erase(iter);
+    else
+      ++iter;
+  }
+
+  // The caches of the call sites just destroyed are dropped. The targets
+  // cached by the others may be functions that were just destroyed.
+  for (auto iter = call_indirect_caches_.begin();
+       iter != call_indirect_caches_.end();) {
+    if (iter->first >= mark.istream_size)
+      iter = call_indirect_caches_.erase(iter);
+    else
+      ++iter;
+  }
+  ClearCallIndirectCaches();
+}
+
+void Environment::ClearCallIndirectCaches() {
+  for (auto& entry : call_indirect_caches_) {
+    for (CallIndirectCache::Slot& slot : entry.second.slots) {
+      slot.entry_index = kInvalidIndex;
+      slot.jit_fn = nullptr;
+    }
+  }
 }
 
 HostModule* Environment::AppendHostModule(string_view name) {
@@ -492,9 +543,13 @@ template<> struct WrapMemType<double, double> { typedef uint64_t type; };
 template <typename T>
 Value MakeValue(ValueTypeRep<T>);
 
+// The 32-bit values also clear the upper half of the Value, so a Value kept
+// in a register (see Thread::RunIstream) is replaced rather than merged with
+// its previous upper bits.
 template <>
 Value MakeValue<uint32_t>(uint32_t v) {
   Value result;
+  result.i64 = 0;
   result.i32 = v;
   return result;
 }
@@ -502,6 +557,7 @@ Value MakeValue<uint32_t>(uint32_t v) {
 template <>
 Value MakeValue<int32_t>(uint32_t v) {
   Value result;
+  result.i64 = 0;
   result.i32 = v;
   return result;
 }
@@ -523,6 +579,7 @@ Value MakeValue<int64_t>(uint64_t v) {
 template <>
 Value MakeValue<float>(uint32_t v) {
   Value result;
+  result.i64 = 0;
   result.f32_bits = v;
   return result;
 }
@@ -556,7 +613,7 @@ template<> uint64_t GetValue<double>(Value v) { return v.f64_bits; }
 #define PUSH_NEG_1_AND_BREAK_IF(cond) \
   if (WABT_UNLIKELY(cond)) {          \
     CHECK_TRAP(Push<int32_t>(-1));    \
-    break;                            \
+    NEXT();                           \
   }
 
 #define GOTO(offset) pc = &istream[offset]
@@ -591,6 +648,13 @@ inline uint32_t ReadU32(const uint8_t** pc) {
   return ReadUx<uint32_t>(pc);
 }
 
+// Skips the immediates of a register binop, returning a pointer to them.
+inline const uint8_t* SkipRegisterOperands(const uint8_t** pc) {
+  const uint8_t* operands = *pc;
+  *pc += 3 * sizeof(uint32_t) + sizeof(uint8_t);
+  return operands;
+}
+
 inline uint64_t ReadU64At(const uint8_t* pc) {
   return ReadUxAt<uint64_t>(pc);
 }
@@ -599,17 +663,203 @@ inline uint64_t ReadU64(const uint8_t** pc) {
   return ReadUx<uint64_t>(pc);
 }
 
-inline Opcode ReadOpcode(const uint8_t** pc) {
+// Opcode::FromCode does a log2(n) lookup from the encoding, which is too slow
+// to do for every instruction executed. The opcodes of all encodings are
+// looked up once instead.
+struct OpcodeDecodeTable {
+  static const int kMaxPrefixBytes = 4;
+
+  OpcodeDecodeTable() {
+    int num_prefix_bytes = 0;
+    for (uint32_t value = 0; value < 256; ++value) {
+      opcodes[value] = Opcode::FromCode(value);
+      prefix_index[value] = 0;
+      if (Opcode::IsPrefixByte(value)) {
+        assert(num_prefix_bytes < kMaxPrefixBytes);
+        prefix_index[value] = num_prefix_bytes;
+        for (uint32_t code = 0; code < 256; ++code) {
+          prefixed_opcodes[num_prefix_bytes][code] =
+              Opcode::FromCode(value, code);
+        }
+        ++num_prefix_bytes;
+      }
+    }
+  }
+
+  Opcode opcodes[256];
+  // Row of prefixed_opcodes for each prefix byte
+  uint8_t prefix_index[256];
+  // By the byte following the prefix byte
+  Opcode prefixed_opcodes[kMaxPrefixBytes][256];
+};
+
+// Built on first use, as the opcode infos it is built from are dynamically
+// initialized too. Callers decoding many instructions should get the table
+// once, rather than going through the initialization guard every time.
+static const OpcodeDecodeTable& GetOpcodeDecodeTable() {
+  static const OpcodeDecodeTable s_opcode_decode_table;
+  return s_opcode_decode_table;
+}
+
+inline Opcode ReadOpcode(const OpcodeDecodeTable& table, const uint8_t** pc) {
   uint8_t value = ReadU8(pc);
   if (Opcode::IsPrefixByte(value)) {
     // For now, assume all instructions are encoded with just one extra byte
     // so we don't have to decode LEB128 here.
-    uint32_t code = ReadU8(pc);
-    return Opcode::FromCode(value, code);
+    uint8_t code = ReadU8(pc);
+    return table.prefixed_opcodes[table.prefix_index[value]][code];
   } else {
-    // TODO(binji): Optimize if needed; Opcode::FromCode does a log2(n) lookup
-    // from the encoding.
-    return Opcode::FromCode(value);
+    return table.opcodes[value];
+  }
+}
+
+inline Opcode ReadOpcode(const uint8_t** pc) {
+  return ReadOpcode(GetOpcodeDecodeTable(), pc);
+}
+
+bool IsRegisterBinop(Opcode opcode) {
+  switch (opcode) {
+    case Opcode::I32Add:
+    case Opcode::I32Sub:
+    case Opcode::I32Mul:
+    case Opcode::I32DivS:
+    case Opcode::I32DivU:
+    case Opcode::I32RemS:
+    case Opcode::I32RemU:
+    case Opcode::I32And:
+    case Opcode::I32Or:
+    case Opcode::I32Xor:
+    case Opcode::I32Shl:
+    case Opcode::I32ShrS:
+    case Opcode::I32ShrU:
+    case Opcode::I32Rotl:
+    case Opcode::I32Rotr:
+    case Opcode::I32Eq:
+    case Opcode::I32Ne:
+    case Opcode::I32LtS:
+    case Opcode::I32LtU:
+    case Opcode::I32GtS:
+    case Opcode::I32GtU:
+    case Opcode::I32LeS:
+    case Opcode::I32LeU:
+    case Opcode::I32GeS:
+    case Opcode::I32GeU:
+    case Opcode::I64Add:
+    case Opcode::I64Sub:
+    case Opcode::I64Mul:
+    case Opcode::I64DivS:
+    case Opcode::I64DivU:
+    case Opcode::I64RemS:
+    case Opcode::I64RemU:
+    case Opcode::I64And:
+    case Opcode::I64Or:
+    case Opcode::I64Xor:
+    case Opcode::I64Shl:
+    case Opcode::I64ShrS:
+    case Opcode::I64ShrU:
+    case Opcode::I64Rotl:
+    case Opcode::I64Rotr:
+    case Opcode::I64Eq:
+    case Opcode::I64Ne:
+    case Opcode::I64LtS:
+    case Opcode::I64LtU:
+    case Opcode::I64GtS:
+    case Opcode::I64GtU:
+    case Opcode::I64LeS:
+    case Opcode::I64LeU:
+    case Opcode::I64GeS:
+    case Opcode::I64GeU:
+    case Opcode::F32Add:
+    case Opcode::F32Sub:
+    case Opcode::F32Mul:
+    case Opcode::F32Div:
+    case Opcode::F32Min:
+    case Opcode::F32Max:
+    case Opcode::F32Copysign:
+    case Opcode::F32Eq:
+    case Opcode::F32Ne:
+    case Opcode::F32Lt:
+    case Opcode::F32Gt:
+    case Opcode::F32Le:
+    case Opcode::F32Ge:
+    case Opcode::F64Add:
+    case Opcode::F64Sub:
+    case Opcode::F64Mul:
+    case Opcode::F64Div:
+    case Opcode::F64Min:
+    case Opcode::F64Max:
+    case Opcode::F64Copysign:
+    case Opcode::F64Eq:
+    case Opcode::F64Ne:
+    case Opcode::F64Lt:
+    case Opcode::F64Gt:
+    case Opcode::F64Le:
+    case Opcode::F64Ge:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Whether the handler of |opcode| in Thread::RunIstream works with the cached
+// top-of-stack value. The handlers of all other opcodes see it spilled to the
+// value stack.
+static bool HandlesCachedTos(Opcode opcode) {
+  if (IsRegisterBinop(opcode)) {
+    return true;
+  }
+
+  switch (opcode) {
+    case Opcode::Select:
+    case Opcode::Br:
+    case Opcode::BrIf:
+    case Opcode::I32Const:
+    case Opcode::I64Const:
+    case Opcode::F32Const:
+    case Opcode::F64Const:
+    case Opcode::GetLocal:
+    case Opcode::SetLocal:
+    case Opcode::TeeLocal:
+    case Opcode::I32Eqz:
+    case Opcode::I64Eqz:
+    case Opcode::F32Abs:
+    case Opcode::F32Neg:
+    case Opcode::F32Ceil:
+    case Opcode::F32Floor:
+    case Opcode::F32Trunc:
+    case Opcode::F32Nearest:
+    case Opcode::F32Sqrt:
+    case Opcode::F64Abs:
+    case Opcode::F64Neg:
+    case Opcode::F64Ceil:
+    case Opcode::F64Floor:
+    case Opcode::F64Trunc:
+    case Opcode::F64Nearest:
+    case Opcode::F64Sqrt:
+    case Opcode::I32TruncSSatF32:
+    case Opcode::I32TruncSSatF64:
+    case Opcode::I32TruncUSatF32:
+    case Opcode::I32TruncUSatF64:
+    case Opcode::I64TruncSSatF32:
+    case Opcode::I64TruncSSatF64:
+    case Opcode::I64TruncUSatF32:
+    case Opcode::I64TruncUSatF64:
+    case Opcode::I32Extend8S:
+    case Opcode::I32Extend16S:
+    case Opcode::I64Extend8S:
+    case Opcode::I64Extend16S:
+    case Opcode::I64Extend32S:
+    case Opcode::InterpBrUnless:
+    case Opcode::Drop:
+    case Opcode::InterpGetLocalGetLocal:
+    case Opcode::InterpGetLocalGetLocalI32Add:
+    case Opcode::InterpGetLocalI32Const:
+    case Opcode::InterpGetLocalI32ConstI32Add:
+      return true;
+
+    default:
+      return false;
   }
 }
 
@@ -631,8 +881,14 @@ template <typename MemType>
 Result Thread::GetAccessAddress(const uint8_t** pc, void** out_address) {
   Memory* memory = ReadMemory(pc);
   uint64_t addr = static_cast<uint64_t>(Pop<uint32_t>()) + ReadU32(pc);
-  TRAP_IF(addr + sizeof(MemType) > memory->data.size(),
-          MemoryAccessOutOfBounds);
+  if (memory->data.guarded()) {
+    // An out-of-bounds access faults, so the pc must be up to date to report
+    // the trap.
+    pc_ = *pc - GetIstream();
+  } else {
+    TRAP_IF(addr + sizeof(MemType) > memory->data.size(),
+            MemoryAccessOutOfBounds);
+  }
   *out_address = memory->data.data() + static_cast<IstreamOffset>(addr);
   return Result::Ok;
 }
@@ -657,10 +913,17 @@ Value& Thread::Pick(Index depth) {
   return value_stack_[value_stack_top_ - depth];
 }
 
+Value& Thread::Local(Index offset) {
+  // The offsets of the params are negative, and wrap around.
+  return value_stack_[frame_base_ + offset];
+}
+
 void Thread::Reset() {
   pc_ = 0;
   value_stack_top_ = 0;
   call_stack_top_ = 0;
+  frame_base_ = 0;
+  last_jit_frame_ = 0;
 }
 
 Result Thread::Push(Value value) {
@@ -707,12 +970,31 @@ void Thread::DropKeep(uint32_t drop_count, uint8_t keep_count) {
 
 Result Thread::PushCall(const uint8_t* pc) {
   TRAP_IF(call_stack_top_ >= call_stack_.size(), CallStackExhausted);
-  call_stack_[call_stack_top_++] = pc - GetIstream();
+  call_stack_[call_stack_top_++] = {static_cast<IstreamOffset>(pc - GetIstream()),
+                                    frame_base_};
+  frame_base_ = value_stack_top_;
   return Result::Ok;
 }
 
+// JITed code accesses guarded memories without bounds checks, so an
+// out-of-bounds access faults and lands here (see GuardPageTrapScope). The
+// thread's pc was already set by the code performing the access. The jump only
+// skips JITed frames: JITed code reaches C++ code through helpers, which call
+// back into JITed code through here again.
+Result Thread::CallJITed(Environment::JITedFunction fn) {
+#if WABT_GUARD_PAGE_MEMORY
+  GuardPageTrapScope trap_scope;
+  if (sigsetjmp(*trap_scope.jump_buffer(), 0) != 0) {
+    return Result::TrapMemoryAccessOutOfBounds;
+  }
+#endif
+  return fn(this);
+}
+
 IstreamOffset Thread::PopCall() {
-  return call_stack_[--call_stack_top_];
+  const CallFrame& frame = call_stack_[--call_stack_top_];
+  frame_base_ = frame.frame_base;
+  return frame.return_offset;
 }
 
 template <typename T>
@@ -829,6 +1111,74 @@ Result Thread::BinopTrap(BinopTrapFunc<R, T> func) {
   return PushRep<R>(result_value);
 }
 
+template <typename R, typename T>
+Result Thread::RegisterBinop(BinopFunc<R, T> func, const uint8_t* operands) {
+  auto lhs_rep = GetValue<T>(Pick(ReadU32At(operands)));
+  auto rhs_rep = GetValue<T>(Pick(ReadU32At(operands + 4)));
+  return StoreRegisterResult<R>(func(lhs_rep, rhs_rep), operands);
+}
+
+template <typename R, typename T>
+Result Thread::RegisterBinopTrap(BinopTrapFunc<R, T> func,
+                                 const uint8_t* operands) {
+  auto lhs_rep = GetValue<T>(Pick(ReadU32At(operands)));
+  auto rhs_rep = GetValue<T>(Pick(ReadU32At(operands + 4)));
+  ValueTypeRep<R> result_value;
+  CHECK_TRAP(func(lhs_rep, rhs_rep, &result_value));
+  return StoreRegisterResult<R>(result_value, operands);
+}
+
+template <typename R>
+Result Thread::StoreRegisterResult(ValueTypeRep<R> value,
+                                   const uint8_t* operands) {
+  Index dest = ReadU32At(operands + 8);
+  value_stack_top_ -= ReadU8At(operands + 12);
+  if (dest == 0) {
+    return PushRep<R>(value);
+  }
+  Pick(dest) = MakeValue<R>(value);
+  return Result::Ok;
+}
+
+template <typename R, typename T>
+Value Thread::TosUnop(UnopFunc<R, T> func, Value value) {
+  return MakeValue<R>(func(GetValue<T>(value)));
+}
+
+// Pops the lhs from the value stack, so the result replaces it as the cached
+// top-of-stack value.
+template <typename R, typename T>
+Value Thread::TosBinop(BinopFunc<R, T> func, Value rhs) {
+  --value_stack_top_;
+  return MakeValue<R>(func(GetValue<T>(Top()), GetValue<T>(rhs)));
+}
+
+// Makes room for a new cached top-of-stack value, spilling |tos|.
+Result Thread::PushTos(Value tos) {
+  SpillTos(tos);
+  CHECK_STACK();
+  ++value_stack_top_;
+  return Result::Ok;
+}
+
+void Thread::SpillTos(Value tos) {
+  if (WABT_LIKELY(value_stack_top_ != 0)) {
+    Top() = tos;
+  }
+}
+
+Value Thread::FillTos() {
+  return WABT_LIKELY(value_stack_top_ != 0) ? Top() : Value();
+}
+
+Value& Thread::BinopLhs(const uint8_t* pc) {
+  return Pick(env_->register_istream ? ReadU32At(pc) : 2);
+}
+
+Value& Thread::BinopRhs(const uint8_t* pc) {
+  return Pick(env_->register_istream ? ReadU32At(pc + 4) : 1);
+}
+
 // {i,f}{32,64}.add
 template <typename T>
 ValueTypeRep<T> Add(ValueTypeRep<T> lhs_rep, ValueTypeRep<T> rhs_rep) {
@@ -1186,7 +1536,69 @@ ValueTypeRep<T> Xchg(ValueTypeRep<T> lhs_rep, ValueTypeRep<T> rhs_rep) {
   return rhs_rep;
 }
 
-bool Environment::TryJit(Thread* t, IstreamOffset offset, Environment::JITedFunction* fn) {
+Index Environment::JitCompileAll() {
+  if (!enable_jit) {
+    return 0;
+  }
+
+  WaitForBackgroundJit();
+
+  // JitBuilder can only compile one function at a time, so there is nothing
+  // to gain from compiling on several threads.
+  Index count = 0;
+  for (auto& entry : jit_meta_) {
+    if (!entry.second.jit_requested.exchange(true)) {
+      Compile(&entry.second);
+      ++count;
+    }
+  }
+
+  return count;
+}
+
+void Environment::Compile(JitMeta* meta) {
+  meta->jit_fn.store(jit::compile(this, meta->wasm_fn, meta->osr_offset), std::memory_order_release);
+  meta->compiled.store(true, std::memory_order_release);
+}
+
+void Environment::CountUse(JitMeta* meta, uint32_t threshold) {
+  if (meta->jit_requested.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  uint32_t num_calls = meta->num_calls.fetch_add(1, std::memory_order_relaxed) + 1;
+
+  // Several threads may reach the threshold at once, only the first one to
+  // request the compilation does it
+  if (num_calls >= threshold && !meta->jit_requested.exchange(true)) {
+    if (background_jit) {
+      background_compiler_.Enqueue([this, meta]() { Compile(meta); });
+    } else {
+      Compile(meta);
+    }
+  }
+}
+
+void Environment::TierUp(JitMeta* meta) {
+  if (meta->tier_up_requested.exchange(true)) {
+    return;
+  }
+
+  auto recompile = [this, meta]() {
+    // The tier 1 code is kept if the recompilation fails
+    if (auto jit_fn = jit::compile(this, meta->wasm_fn, meta->osr_offset, 2)) {
+      meta->jit_fn.store(jit_fn, std::memory_order_release);
+    }
+  };
+
+  if (background_jit) {
+    background_compiler_.Enqueue(recompile);
+  } else {
+    recompile();
+  }
+}
+
+bool Environment::TryJit(IstreamOffset offset, Environment::JITedFunction* fn) {
   if (!enable_jit) {
     *fn = nullptr;
     return false;
@@ -1196,19 +1608,15 @@ bool Environment::TryJit(Thread* t, IstreamOffset offset, Environment::JITedFunc
 
   if (meta_it != jit_meta_.end()) {
     auto* meta = &meta_it->second;
-    if (!meta->tried_jit) {
-      meta->num_calls++;
-
-      if (meta->num_calls >= jit_threshold) {
-        meta->jit_fn = jit::compile(t, meta->wasm_fn);
-        meta->tried_jit = true;
-      } else {
-        *fn = nullptr;
-        return false;
-      }
+    CountUse(meta, jit_threshold);
+
+    // Keep interpreting until the compilation is done
+    if (!meta->compiled.load(std::memory_order_acquire)) {
+      *fn = nullptr;
+      return false;
     }
 
-    *fn = meta->jit_fn;
+    *fn = meta->jit_fn.load(std::memory_order_relaxed);
     return trap_on_failed_comp || *fn;
   } else {
     *fn = nullptr;
@@ -1216,14 +1624,37 @@ bool Environment::TryJit(Thread* t, IstreamOffset offset, Environment::JITedFunc
   }
 }
 
+bool Environment::TryOsr(IstreamOffset loop_offset, Environment::JITedFunction* fn) {
+  *fn = nullptr;
+  if (!enable_jit || osr_threshold == 0) {
+    return false;
+  }
+
+  auto meta_it = osr_meta_.find(loop_offset);
+  if (meta_it == osr_meta_.end()) {
+    return false;
+  }
+
+  auto* meta = &meta_it->second;
+  CountUse(meta, osr_threshold);
+
+  // Failed compilations never trap, the loop just keeps being interpreted
+  if (meta->compiled.load(std::memory_order_acquire)) {
+    *fn = meta->jit_fn.load(std::memory_order_relaxed);
+  }
+  return *fn != nullptr;
+}
+
+Index Environment::InternFuncSignature(const FuncSignature& sig,
+                                       Index sig_index) {
+  auto key = std::make_pair(sig.param_types, sig.result_types);
+  return canonical_sigs_.emplace(std::move(key), sig_index).first->second;
+}
+
 bool Environment::FuncSignaturesAreEqual(Index sig_index_0,
                                          Index sig_index_1) const {
-  if (sig_index_0 == sig_index_1)
-    return true;
-  const FuncSignature* sig_0 = &sigs_[sig_index_0];
-  const FuncSignature* sig_1 = &sigs_[sig_index_1];
-  return sig_0->param_types == sig_1->param_types &&
-         sig_0->result_types == sig_1->result_types;
+  return sigs_[sig_index_0].canonical_index ==
+         sigs_[sig_index_1].canonical_index;
 }
 
 Result Thread::CallHost(HostFunc* func) {
@@ -1273,37 +1704,230 @@ class TempPc {
     const uint8_t* pc;
 };
 
+#if WITH_THREADED_DISPATCH && (COMPILER_IS_GNU || COMPILER_IS_CLANG)
+#define WABT_THREADED_DISPATCH 1
+#else
+#define WABT_THREADED_DISPATCH 0
+#endif
+
+// Each instruction handler of Thread::Run is a case of the switch, which ends
+// with NEXT(). With threaded dispatch, NEXT() jumps directly to the handler of
+// the following instruction instead of going back to the switch, so each
+// handler has its own indirect branch, predicted separately. Only the first
+// instruction is dispatched by the switch.
+//
+// With top-of-stack caching (kCacheTos), the value at the top of the value
+// stack is kept in |tos| instead of value_stack_[value_stack_top_ - 1], so
+// sequences of constants, locals and operators don't store and reload every
+// intermediate value. Only the handlers listed in HandlesCachedTos know about
+// |tos|; they end with TOS_NEXT(). All others are entered with |tos| spilled
+// to the value stack and reload it in NEXT(), so they, and anything they call
+// (host functions, JITed code, traps), see the complete value stack.
+#if WABT_THREADED_DISPATCH
+#define CASE(name) case Opcode::name: op_##name
+#define DISPATCH()                                     \
+  do {                                                 \
+    opcode = ReadOpcode(decode_table, &pc);            \
+    assert(!opcode.IsInvalid());                       \
+    goto*(kCacheTos ? kTosHandlers : kHandlers)[opcode]; \
+  } while (0)
+#define NEXT()                                  \
+  do {                                          \
+    if (WABT_UNLIKELY(++i >= num_instructions)) \
+      goto exit_loop;                           \
+    if (kCacheTos)                              \
+      tos = FillTos();                          \
+    DISPATCH();                                 \
+  } while (0)
+#define TOS_NEXT()                                \
+  do {                                            \
+    if (WABT_UNLIKELY(++i >= num_instructions)) { \
+      if (kCacheTos)                              \
+        SpillTos(tos);                            \
+      goto exit_loop;                             \
+    }                                             \
+    DISPATCH();                                   \
+  } while (0)
+#else
+#define CASE(name) case Opcode::name
+#define NEXT()         \
+  {                    \
+    if (kCacheTos)     \
+      tos = FillTos(); \
+  }                    \
+  break
+#define TOS_NEXT() break
+#endif
+
+// In a register istream, binary operators read their operands and store their
+// result at the depths following the opcode (see IsRegisterBinop). The helpers
+// receive a copy of |pc| so it can stay in a register in the dispatch loop.
+#define BINOP(func)                                               \
+  do {                                                            \
+    if (kRegisterIstream) {                                       \
+      CHECK_TRAP(RegisterBinop(func, SkipRegisterOperands(&pc))); \
+    } else if (kCacheTos) {                                       \
+      tos = TosBinop(func, tos);                                  \
+    } else {                                                      \
+      CHECK_TRAP(Binop(func));                                    \
+    }                                                             \
+  } while (0)
+#define BINOP_TRAP(func)                                              \
+  do {                                                                \
+    if (kRegisterIstream) {                                           \
+      CHECK_TRAP(RegisterBinopTrap(func, SkipRegisterOperands(&pc))); \
+    } else if (kCacheTos) {                                           \
+      SpillTos(tos);                                                  \
+      CHECK_TRAP(BinopTrap(func));                                    \
+      tos = Top();                                                    \
+    } else {                                                          \
+      CHECK_TRAP(BinopTrap(func));                                    \
+    }                                                                 \
+  } while (0)
+
+#define UNOP(...)                      \
+  do {                                 \
+    if (kCacheTos) {                   \
+      tos = TosUnop(__VA_ARGS__, tos); \
+    } else {                           \
+      CHECK_TRAP(Unop(__VA_ARGS__));   \
+    }                                  \
+  } while (0)
+
+// Pushes |value| of type T, which must not be read from the value stack.
+#define PUSH_REP(T, value)           \
+  do {                               \
+    if (kCacheTos) {                 \
+      CHECK_TRAP(PushTos(tos));      \
+      tos = MakeValue<T>(value);     \
+    } else {                         \
+      CHECK_TRAP(PushRep<T>(value)); \
+    }                                \
+  } while (0)
+
 Result Thread::Run(int num_instructions) {
+  TempPc tpc(this);
+#if WABT_GUARD_PAGE_MEMORY
+  // Guarded memories are accessed without bounds checks, so an out-of-bounds
+  // access faults and lands here (see GuardPageTrapScope). The thread's pc was
+  // already set by the code performing the access.
+  GuardPageTrapScope trap_scope;
+  if (sigsetjmp(*trap_scope.jump_buffer(), 0) != 0) {
+    tpc.Reload();
+    return Result::TrapMemoryAccessOutOfBounds;
+  }
+#endif
+
+  if (env_->register_istream) {
+    return RunIstream<true, false>(num_instructions, &tpc);
+  }
+  return cache_top_of_stack_
+             ? RunIstream<false, true>(num_instructions, &tpc)
+             : RunIstream<false, false>(num_instructions, &tpc);
+}
+
+// The jump of an out-of-bounds access to a guarded memory skips the frames of
+// RunIstream (and of the helpers it calls), so they must not have locals with
+// destructors. |tpc| is owned by Thread::Run for that reason.
+template <bool kRegisterIstream, bool kCacheTos>
+Result Thread::RunIstream(int num_instructions, TempPc* tpc) {
   Result result = Result::Ok;
 
-  TempPc tpc(this);
-  const uint8_t*& istream = tpc.istream;
-  const uint8_t*& pc = tpc.pc;
+  const uint8_t*& istream = tpc->istream;
+  const uint8_t*& pc = tpc->pc;
+  Value tos = kCacheTos ? FillTos() : Value();
+  const OpcodeDecodeTable& decode_table = GetOpcodeDecodeTable();
+
+#if WABT_THREADED_DISPATCH
+  // Indexed by Opcode::Enum
+  static const void* const kHandlers[] = {
+#define WABT_OPCODE(rtype, type1, type2, type3, mem_size, prefix, code, Name, \
+                    text)                                                     \
+  &&op_##Name,
+#include "src/opcode.def"
+#undef WABT_OPCODE
+      &&op_Invalid,
+  };
+
+  // Used with top-of-stack caching. Handlers that don't know about |tos| are
+  // entered through a stub spilling it (see the end of the switch).
+  static const void* const kTosHandlers[] = {
+#define WABT_OPCODE(rtype, type1, type2, type3, mem_size, prefix, code, Name, \
+                    text)                                                     \
+  HandlesCachedTos(Opcode::Name) ? &&op_##Name : &&spill_##Name,
+#include "src/opcode.def"
+#undef WABT_OPCODE
+      &&op_Invalid,
+  };
+#endif
 
   for (int i = 0; i < num_instructions; ++i) {
-    Opcode opcode = ReadOpcode(&pc);
+    Opcode opcode = ReadOpcode(decode_table, &pc);
     assert(!opcode.IsInvalid());
+    if (kCacheTos && !HandlesCachedTos(opcode)) {
+      SpillTos(tos);
+    }
     switch (opcode) {
-      case Opcode::Select: {
+      CASE(Select): {
+        if (kCacheTos) {
+          uint32_t cond = GetValue<uint32_t>(tos);
+          Value false_ = Pick(2);
+          value_stack_top_ -= 2;
+          tos = cond ? Top() : false_;
+          TOS_NEXT();
+        }
         uint32_t cond = Pop<uint32_t>();
         Value false_ = Pop();
         Value true_ = Pop();
         CHECK_TRAP(Push(cond ? true_ : false_));
-        break;
+        NEXT();
       }
 
-      case Opcode::Br:
-        GOTO(ReadU32(&pc));
-        break;
+      CASE(Br): {
+        IstreamOffset new_pc = ReadU32(&pc);
+        Environment::JITedFunction osr_fn;
+
+        // Backward branches go to loop headers. Once a loop has run often
+        // enough, the rest of the function runs compiled code entered there.
+        if (&istream[new_pc] < pc && env_->TryOsr(new_pc, &osr_fn)) {
+          if (kCacheTos) {
+            SpillTos(tos);
+          }
+          auto osr_result = CallJITed(osr_fn);
+          if (osr_result != Result::Ok) {
+            tpc->Reload();
+            return osr_result;
+          }
+
+          // The compiled code has returned from the function
+          if (call_stack_top_ == 0 || call_stack_top_ == last_jit_frame_) {
+            result = Result::Returned;
+            goto exit_loop;
+          }
+          GOTO(PopCall());
+          NEXT();
+        }
 
-      case Opcode::BrIf: {
+        GOTO(new_pc);
+        TOS_NEXT();
+      }
+
+      CASE(BrIf): {
         IstreamOffset new_pc = ReadU32(&pc);
+        if (kCacheTos) {
+          uint32_t cond = GetValue<uint32_t>(tos);
+          --value_stack_top_;
+          tos = FillTos();
+          if (cond)
+            GOTO(new_pc);
+          TOS_NEXT();
+        }
         if (Pop<uint32_t>())
           GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case Opcode::BrTable: {
+      CASE(BrTable): {
         Index num_targets = ReadU32(&pc);
         IstreamOffset table_offset = ReadU32(&pc);
         uint32_t key = Pop<uint32_t>();
@@ -1316,79 +1940,91 @@ Result Thread::Run(int num_instructions) {
         read_table_entry_at(entry, &new_pc, &drop_count, &keep_count);
         DropKeep(drop_count, keep_count);
         GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case Opcode::Return:
+      CASE(Return):
         if (call_stack_top_ == 0 || call_stack_top_ == last_jit_frame_) {
           result = Result::Returned;
           goto exit_loop;
         }
         GOTO(PopCall());
-        break;
+        NEXT();
 
-      case Opcode::Unreachable:
+      CASE(Unreachable):
         TRAP(Unreachable);
-        break;
+        NEXT();
 
-      case Opcode::I32Const:
-        CHECK_TRAP(Push<uint32_t>(ReadU32(&pc)));
-        break;
+      CASE(I32Const):
+        PUSH_REP(uint32_t, ReadU32(&pc));
+        TOS_NEXT();
 
-      case Opcode::I64Const:
-        CHECK_TRAP(Push<uint64_t>(ReadU64(&pc)));
-        break;
+      CASE(I64Const):
+        PUSH_REP(uint64_t, ReadU64(&pc));
+        TOS_NEXT();
 
-      case Opcode::F32Const:
-        CHECK_TRAP(PushRep<float>(ReadU32(&pc)));
-        break;
+      CASE(F32Const):
+        PUSH_REP(float, ReadU32(&pc));
+        TOS_NEXT();
 
-      case Opcode::F64Const:
-        CHECK_TRAP(PushRep<double>(ReadU64(&pc)));
-        break;
+      CASE(F64Const):
+        PUSH_REP(double, ReadU64(&pc));
+        TOS_NEXT();
 
-      case Opcode::GetGlobal: {
+      CASE(GetGlobal): {
         Index index = ReadU32(&pc);
         assert(index < env_->globals_.size());
         CHECK_TRAP(Push(env_->globals_[index].typed_value.value));
-        break;
+        NEXT();
       }
 
-      case Opcode::SetGlobal: {
+      CASE(SetGlobal): {
         Index index = ReadU32(&pc);
         assert(index < env_->globals_.size());
         env_->globals_[index].typed_value.value = Pop();
-        break;
+        NEXT();
       }
 
-      case Opcode::GetLocal: {
-        Value value = Pick(ReadU32(&pc));
-        CHECK_TRAP(Push(value));
-        break;
+      CASE(GetLocal): {
+        if (kCacheTos) {
+          // The local may be the cached value itself, so it is read after
+          // spilling |tos|.
+          CHECK_TRAP(PushTos(tos));
+          tos = Local(ReadU32(&pc));
+          TOS_NEXT();
+        }
+        CHECK_TRAP(Push(Local(ReadU32(&pc))));
+        NEXT();
       }
 
-      case Opcode::SetLocal: {
-        Value value = Pop();
-        Pick(ReadU32(&pc)) = value;
-        break;
+      CASE(SetLocal): {
+        if (kCacheTos) {
+          // The local is written before reloading |tos|, which may be it.
+          Local(ReadU32(&pc)) = tos;
+          --value_stack_top_;
+          tos = Top();
+          TOS_NEXT();
+        }
+        Local(ReadU32(&pc)) = Pop();
+        NEXT();
       }
 
-      case Opcode::TeeLocal:
-        Pick(ReadU32(&pc)) = Top();
-        break;
+      CASE(TeeLocal):
+        Local(ReadU32(&pc)) = kCacheTos ? tos : Top();
+        TOS_NEXT();
 
-      case Opcode::Call: {
+      CASE(Call): {
         IstreamOffset offset = ReadU32(&pc);
         Environment::JITedFunction jit_fn;
 
-        if (env_->TryJit(this, offset, &jit_fn)) {
+        if (env_->TryJit(offset, &jit_fn)) {
           TRAP_IF(!jit_fn, FailedJITCompilation);
           CHECK_TRAP(PushCall(pc));
 
-          auto result = jit_fn();
+          auto result = CallJITed(jit_fn);
           if (result != Result::Ok) {
             // We don't want to overwrite the pc of the JITted function if it traps
-            tpc.Reload();
+            tpc->Reload();
 
             return result;
           }
@@ -1398,10 +2034,10 @@ Result Thread::Run(int num_instructions) {
           CHECK_TRAP(PushCall(pc));
           GOTO(offset);
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::CallIndirect: {
+      CASE(CallIndirect): {
         Index table_index = ReadU32(&pc);
         Table* table = &env_->tables_[table_index];
         Index sig_index = ReadU32(&pc);
@@ -1409,23 +2045,24 @@ Result Thread::Run(int num_instructions) {
         TRAP_IF(entry_index >= table->func_indexes.size(), UndefinedTableIndex);
         Index func_index = table->func_indexes[entry_index];
         TRAP_IF(func_index == kInvalidIndex, UninitializedTableElement);
-        Func* func = env_->funcs_[func_index].get();
-        TRAP_UNLESS(env_->FuncSignaturesAreEqual(func->sig_index, sig_index),
+        TRAP_UNLESS(table->canonical_sig_indexes[entry_index] ==
+                        env_->sigs_[sig_index].canonical_index,
                     IndirectCallSignatureMismatch);
+        Func* func = env_->funcs_[func_index].get();
         if (func->is_host) {
           CHECK_TRAP(CallHost(cast<HostFunc>(func)));
         } else {
           auto* dfn = cast<DefinedFunc>(func);
           Environment::JITedFunction jit_fn;
 
-          if (env_->TryJit(this, dfn->offset, &jit_fn)) {
+          if (env_->TryJit(dfn->offset, &jit_fn)) {
             TRAP_IF(!jit_fn, FailedJITCompilation);
             CHECK_TRAP(PushCall(pc));
 
-            auto result = jit_fn();
+            auto result = CallJITed(jit_fn);
             if (result != Result::Ok) {
               // We don't want to overwrite the pc of the JITted function if it traps
-              tpc.Reload();
+              tpc->Reload();
 
               return result;
             }
@@ -1436,185 +2073,185 @@ Result Thread::Run(int num_instructions) {
             GOTO(dfn->offset);
           }
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::InterpCallHost: {
+      CASE(InterpCallHost): {
         Index func_index = ReadU32(&pc);
         CHECK_TRAP(CallHost(cast<HostFunc>(env_->funcs_[func_index].get())));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32Load8S:
+      CASE(I32Load8S):
         CHECK_TRAP(Load<int8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load8U:
+      CASE(I32Load8U):
         CHECK_TRAP(Load<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load16S:
+      CASE(I32Load16S):
         CHECK_TRAP(Load<int16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load16U:
+      CASE(I32Load16U):
         CHECK_TRAP(Load<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load8S:
+      CASE(I64Load8S):
         CHECK_TRAP(Load<int8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load8U:
+      CASE(I64Load8U):
         CHECK_TRAP(Load<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load16S:
+      CASE(I64Load16S):
         CHECK_TRAP(Load<int16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load16U:
+      CASE(I64Load16U):
         CHECK_TRAP(Load<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load32S:
+      CASE(I64Load32S):
         CHECK_TRAP(Load<int32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load32U:
+      CASE(I64Load32U):
         CHECK_TRAP(Load<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Load:
+      CASE(I32Load):
         CHECK_TRAP(Load<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Load:
+      CASE(I64Load):
         CHECK_TRAP(Load<uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F32Load:
+      CASE(F32Load):
         CHECK_TRAP(Load<float>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F64Load:
+      CASE(F64Load):
         CHECK_TRAP(Load<double>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Store8:
+      CASE(I32Store8):
         CHECK_TRAP(Store<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Store16:
+      CASE(I32Store16):
         CHECK_TRAP(Store<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store8:
+      CASE(I64Store8):
         CHECK_TRAP(Store<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store16:
+      CASE(I64Store16):
         CHECK_TRAP(Store<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store32:
+      CASE(I64Store32):
         CHECK_TRAP(Store<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32Store:
+      CASE(I32Store):
         CHECK_TRAP(Store<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64Store:
+      CASE(I64Store):
         CHECK_TRAP(Store<uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F32Store:
+      CASE(F32Store):
         CHECK_TRAP(Store<float>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::F64Store:
+      CASE(F64Store):
         CHECK_TRAP(Store<double>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicLoad8U:
+      CASE(I32AtomicLoad8U):
         CHECK_TRAP(AtomicLoad<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicLoad16U:
+      CASE(I32AtomicLoad16U):
         CHECK_TRAP(AtomicLoad<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad8U:
+      CASE(I64AtomicLoad8U):
         CHECK_TRAP(AtomicLoad<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad16U:
+      CASE(I64AtomicLoad16U):
         CHECK_TRAP(AtomicLoad<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad32U:
+      CASE(I64AtomicLoad32U):
         CHECK_TRAP(AtomicLoad<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicLoad:
+      CASE(I32AtomicLoad):
         CHECK_TRAP(AtomicLoad<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicLoad:
+      CASE(I64AtomicLoad):
         CHECK_TRAP(AtomicLoad<uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicStore8:
+      CASE(I32AtomicStore8):
         CHECK_TRAP(AtomicStore<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicStore16:
+      CASE(I32AtomicStore16):
         CHECK_TRAP(AtomicStore<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore8:
+      CASE(I64AtomicStore8):
         CHECK_TRAP(AtomicStore<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore16:
+      CASE(I64AtomicStore16):
         CHECK_TRAP(AtomicStore<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore32:
+      CASE(I64AtomicStore32):
         CHECK_TRAP(AtomicStore<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicStore:
+      CASE(I32AtomicStore):
         CHECK_TRAP(AtomicStore<uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicStore:
+      CASE(I64AtomicStore):
         CHECK_TRAP(AtomicStore<uint64_t>(&pc));
-        break;
+        NEXT();
 
 #define ATOMIC_RMW(rmwop, func)                                     \
-  case Opcode::I32AtomicRmw##rmwop:                                 \
+  CASE(I32AtomicRmw##rmwop):                                        \
     CHECK_TRAP(AtomicRmw<uint32_t, uint32_t>(func<uint32_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I64AtomicRmw##rmwop:                                 \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw##rmwop):                                        \
     CHECK_TRAP(AtomicRmw<uint64_t, uint64_t>(func<uint64_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I32AtomicRmw8U##rmwop:                               \
+    NEXT();                                                         \
+  CASE(I32AtomicRmw8U##rmwop):                                      \
     CHECK_TRAP(AtomicRmw<uint8_t, uint32_t>(func<uint32_t>, &pc));  \
-    break;                                                          \
-  case Opcode::I32AtomicRmw16U##rmwop:                              \
+    NEXT();                                                         \
+  CASE(I32AtomicRmw16U##rmwop):                                     \
     CHECK_TRAP(AtomicRmw<uint16_t, uint32_t>(func<uint32_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I64AtomicRmw8U##rmwop:                               \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw8U##rmwop):                                      \
     CHECK_TRAP(AtomicRmw<uint8_t, uint64_t>(func<uint64_t>, &pc));  \
-    break;                                                          \
-  case Opcode::I64AtomicRmw16U##rmwop:                              \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw16U##rmwop):                                     \
     CHECK_TRAP(AtomicRmw<uint16_t, uint64_t>(func<uint64_t>, &pc)); \
-    break;                                                          \
-  case Opcode::I64AtomicRmw32U##rmwop:                              \
+    NEXT();                                                         \
+  CASE(I64AtomicRmw32U##rmwop):                                     \
     CHECK_TRAP(AtomicRmw<uint32_t, uint64_t>(func<uint64_t>, &pc)); \
-    break /* no semicolon */
+    NEXT() /* no semicolon */
 
         ATOMIC_RMW(Add, Add);
         ATOMIC_RMW(Sub, Sub);
@@ -1625,39 +2262,39 @@ Result Thread::Run(int num_instructions) {
 
 #undef ATOMIC_RMW
 
-      case Opcode::I32AtomicRmwCmpxchg:
+      CASE(I32AtomicRmwCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint32_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmwCmpxchg:
+      CASE(I64AtomicRmwCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint64_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicRmw8UCmpxchg:
+      CASE(I32AtomicRmw8UCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint8_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I32AtomicRmw16UCmpxchg:
+      CASE(I32AtomicRmw16UCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint16_t, uint32_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmw8UCmpxchg:
+      CASE(I64AtomicRmw8UCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint8_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmw16UCmpxchg:
+      CASE(I64AtomicRmw16UCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint16_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::I64AtomicRmw32UCmpxchg:
+      CASE(I64AtomicRmw32UCmpxchg):
         CHECK_TRAP(AtomicRmwCmpxchg<uint32_t, uint64_t>(&pc));
-        break;
+        NEXT();
 
-      case Opcode::CurrentMemory:
+      CASE(CurrentMemory):
         CHECK_TRAP(Push<uint32_t>(ReadMemory(&pc)->page_limits.initial));
-        break;
+        NEXT();
 
-      case Opcode::GrowMemory: {
+      CASE(GrowMemory): {
         Memory* memory = ReadMemory(&pc);
         uint32_t old_page_size = memory->page_limits.initial;
         uint32_t grow_pages = Pop<uint32_t>();
@@ -1668,487 +2305,488 @@ Result Thread::Run(int num_instructions) {
         PUSH_NEG_1_AND_BREAK_IF(new_page_size > max_page_size);
         PUSH_NEG_1_AND_BREAK_IF(
             static_cast<uint64_t>(new_page_size) * WABT_PAGE_SIZE > UINT32_MAX);
-        memory->data.resize(new_page_size * WABT_PAGE_SIZE);
+        PUSH_NEG_1_AND_BREAK_IF(
+            !memory->data.resize(new_page_size * WABT_PAGE_SIZE));
         memory->page_limits.initial = new_page_size;
         CHECK_TRAP(Push<uint32_t>(old_page_size));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32Add:
-        CHECK_TRAP(Binop(Add<uint32_t>));
-        break;
+      CASE(I32Add):
+        BINOP(Add<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Sub:
-        CHECK_TRAP(Binop(Sub<uint32_t>));
-        break;
+      CASE(I32Sub):
+        BINOP(Sub<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Mul:
-        CHECK_TRAP(Binop(Mul<uint32_t>));
-        break;
+      CASE(I32Mul):
+        BINOP(Mul<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32DivS:
-        CHECK_TRAP(BinopTrap(IntDivS<int32_t>));
-        break;
+      CASE(I32DivS):
+        BINOP_TRAP(IntDivS<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32DivU:
-        CHECK_TRAP(BinopTrap(IntDivU<uint32_t>));
-        break;
+      CASE(I32DivU):
+        BINOP_TRAP(IntDivU<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32RemS:
-        CHECK_TRAP(BinopTrap(IntRemS<int32_t>));
-        break;
+      CASE(I32RemS):
+        BINOP_TRAP(IntRemS<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32RemU:
-        CHECK_TRAP(BinopTrap(IntRemU<uint32_t>));
-        break;
+      CASE(I32RemU):
+        BINOP_TRAP(IntRemU<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32And:
-        CHECK_TRAP(Binop(IntAnd<uint32_t>));
-        break;
+      CASE(I32And):
+        BINOP(IntAnd<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Or:
-        CHECK_TRAP(Binop(IntOr<uint32_t>));
-        break;
+      CASE(I32Or):
+        BINOP(IntOr<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Xor:
-        CHECK_TRAP(Binop(IntXor<uint32_t>));
-        break;
+      CASE(I32Xor):
+        BINOP(IntXor<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Shl:
-        CHECK_TRAP(Binop(IntShl<uint32_t>));
-        break;
+      CASE(I32Shl):
+        BINOP(IntShl<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32ShrU:
-        CHECK_TRAP(Binop(IntShr<uint32_t>));
-        break;
+      CASE(I32ShrU):
+        BINOP(IntShr<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32ShrS:
-        CHECK_TRAP(Binop(IntShr<int32_t>));
-        break;
+      CASE(I32ShrS):
+        BINOP(IntShr<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Eq:
-        CHECK_TRAP(Binop(Eq<uint32_t>));
-        break;
+      CASE(I32Eq):
+        BINOP(Eq<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Ne:
-        CHECK_TRAP(Binop(Ne<uint32_t>));
-        break;
+      CASE(I32Ne):
+        BINOP(Ne<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32LtS:
-        CHECK_TRAP(Binop(Lt<int32_t>));
-        break;
+      CASE(I32LtS):
+        BINOP(Lt<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32LeS:
-        CHECK_TRAP(Binop(Le<int32_t>));
-        break;
+      CASE(I32LeS):
+        BINOP(Le<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32LtU:
-        CHECK_TRAP(Binop(Lt<uint32_t>));
-        break;
+      CASE(I32LtU):
+        BINOP(Lt<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32LeU:
-        CHECK_TRAP(Binop(Le<uint32_t>));
-        break;
+      CASE(I32LeU):
+        BINOP(Le<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32GtS:
-        CHECK_TRAP(Binop(Gt<int32_t>));
-        break;
+      CASE(I32GtS):
+        BINOP(Gt<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32GeS:
-        CHECK_TRAP(Binop(Ge<int32_t>));
-        break;
+      CASE(I32GeS):
+        BINOP(Ge<int32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32GtU:
-        CHECK_TRAP(Binop(Gt<uint32_t>));
-        break;
+      CASE(I32GtU):
+        BINOP(Gt<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32GeU:
-        CHECK_TRAP(Binop(Ge<uint32_t>));
-        break;
+      CASE(I32GeU):
+        BINOP(Ge<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Clz: {
+      CASE(I32Clz): {
         uint32_t value = Pop<uint32_t>();
         CHECK_TRAP(Push<uint32_t>(value != 0 ? wabt_clz_u32(value) : 32));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32Ctz: {
+      CASE(I32Ctz): {
         uint32_t value = Pop<uint32_t>();
         CHECK_TRAP(Push<uint32_t>(value != 0 ? wabt_ctz_u32(value) : 32));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32Popcnt: {
+      CASE(I32Popcnt): {
         uint32_t value = Pop<uint32_t>();
         CHECK_TRAP(Push<uint32_t>(wabt_popcount_u32(value)));
-        break;
+        NEXT();
       }
 
-      case Opcode::I32Eqz:
-        CHECK_TRAP(Unop(IntEqz<uint32_t, uint32_t>));
-        break;
+      CASE(I32Eqz):
+        UNOP(IntEqz<uint32_t, uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Add:
-        CHECK_TRAP(Binop(Add<uint64_t>));
-        break;
+      CASE(I64Add):
+        BINOP(Add<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Sub:
-        CHECK_TRAP(Binop(Sub<uint64_t>));
-        break;
+      CASE(I64Sub):
+        BINOP(Sub<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Mul:
-        CHECK_TRAP(Binop(Mul<uint64_t>));
-        break;
+      CASE(I64Mul):
+        BINOP(Mul<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64DivS:
-        CHECK_TRAP(BinopTrap(IntDivS<int64_t>));
-        break;
+      CASE(I64DivS):
+        BINOP_TRAP(IntDivS<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64DivU:
-        CHECK_TRAP(BinopTrap(IntDivU<uint64_t>));
-        break;
+      CASE(I64DivU):
+        BINOP_TRAP(IntDivU<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64RemS:
-        CHECK_TRAP(BinopTrap(IntRemS<int64_t>));
-        break;
+      CASE(I64RemS):
+        BINOP_TRAP(IntRemS<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64RemU:
-        CHECK_TRAP(BinopTrap(IntRemU<uint64_t>));
-        break;
+      CASE(I64RemU):
+        BINOP_TRAP(IntRemU<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64And:
-        CHECK_TRAP(Binop(IntAnd<uint64_t>));
-        break;
+      CASE(I64And):
+        BINOP(IntAnd<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Or:
-        CHECK_TRAP(Binop(IntOr<uint64_t>));
-        break;
+      CASE(I64Or):
+        BINOP(IntOr<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Xor:
-        CHECK_TRAP(Binop(IntXor<uint64_t>));
-        break;
+      CASE(I64Xor):
+        BINOP(IntXor<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Shl:
-        CHECK_TRAP(Binop(IntShl<uint64_t>));
-        break;
+      CASE(I64Shl):
+        BINOP(IntShl<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64ShrU:
-        CHECK_TRAP(Binop(IntShr<uint64_t>));
-        break;
+      CASE(I64ShrU):
+        BINOP(IntShr<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64ShrS:
-        CHECK_TRAP(Binop(IntShr<int64_t>));
-        break;
+      CASE(I64ShrS):
+        BINOP(IntShr<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Eq:
-        CHECK_TRAP(Binop(Eq<uint64_t>));
-        break;
+      CASE(I64Eq):
+        BINOP(Eq<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Ne:
-        CHECK_TRAP(Binop(Ne<uint64_t>));
-        break;
+      CASE(I64Ne):
+        BINOP(Ne<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64LtS:
-        CHECK_TRAP(Binop(Lt<int64_t>));
-        break;
+      CASE(I64LtS):
+        BINOP(Lt<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64LeS:
-        CHECK_TRAP(Binop(Le<int64_t>));
-        break;
+      CASE(I64LeS):
+        BINOP(Le<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64LtU:
-        CHECK_TRAP(Binop(Lt<uint64_t>));
-        break;
+      CASE(I64LtU):
+        BINOP(Lt<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64LeU:
-        CHECK_TRAP(Binop(Le<uint64_t>));
-        break;
+      CASE(I64LeU):
+        BINOP(Le<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64GtS:
-        CHECK_TRAP(Binop(Gt<int64_t>));
-        break;
+      CASE(I64GtS):
+        BINOP(Gt<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64GeS:
-        CHECK_TRAP(Binop(Ge<int64_t>));
-        break;
+      CASE(I64GeS):
+        BINOP(Ge<int64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64GtU:
-        CHECK_TRAP(Binop(Gt<uint64_t>));
-        break;
+      CASE(I64GtU):
+        BINOP(Gt<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64GeU:
-        CHECK_TRAP(Binop(Ge<uint64_t>));
-        break;
+      CASE(I64GeU):
+        BINOP(Ge<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Clz: {
+      CASE(I64Clz): {
         uint64_t value = Pop<uint64_t>();
         CHECK_TRAP(Push<uint64_t>(value != 0 ? wabt_clz_u64(value) : 64));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64Ctz: {
+      CASE(I64Ctz): {
         uint64_t value = Pop<uint64_t>();
         CHECK_TRAP(Push<uint64_t>(value != 0 ? wabt_ctz_u64(value) : 64));
-        break;
+        NEXT();
       }
 
-      case Opcode::I64Popcnt:
+      CASE(I64Popcnt):
         CHECK_TRAP(Push<uint64_t>(wabt_popcount_u64(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F32Add:
-        CHECK_TRAP(Binop(Add<float>));
-        break;
+      CASE(F32Add):
+        BINOP(Add<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Sub:
-        CHECK_TRAP(Binop(Sub<float>));
-        break;
+      CASE(F32Sub):
+        BINOP(Sub<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Mul:
-        CHECK_TRAP(Binop(Mul<float>));
-        break;
+      CASE(F32Mul):
+        BINOP(Mul<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Div:
-        CHECK_TRAP(Binop(FloatDiv<float>));
-        break;
+      CASE(F32Div):
+        BINOP(FloatDiv<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Min:
-        CHECK_TRAP(Binop(FloatMin<float>));
-        break;
+      CASE(F32Min):
+        BINOP(FloatMin<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Max:
-        CHECK_TRAP(Binop(FloatMax<float>));
-        break;
+      CASE(F32Max):
+        BINOP(FloatMax<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Abs:
-        CHECK_TRAP(Unop(FloatAbs<float>));
-        break;
+      CASE(F32Abs):
+        UNOP(FloatAbs<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Neg:
-        CHECK_TRAP(Unop(FloatNeg<float>));
-        break;
+      CASE(F32Neg):
+        UNOP(FloatNeg<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Copysign:
-        CHECK_TRAP(Binop(FloatCopySign<float>));
-        break;
+      CASE(F32Copysign):
+        BINOP(FloatCopySign<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Ceil:
-        CHECK_TRAP(Unop(FloatCeil<float>));
-        break;
+      CASE(F32Ceil):
+        UNOP(FloatCeil<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Floor:
-        CHECK_TRAP(Unop(FloatFloor<float>));
-        break;
+      CASE(F32Floor):
+        UNOP(FloatFloor<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Trunc:
-        CHECK_TRAP(Unop(FloatTrunc<float>));
-        break;
+      CASE(F32Trunc):
+        UNOP(FloatTrunc<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Nearest:
-        CHECK_TRAP(Unop(FloatNearest<float>));
-        break;
+      CASE(F32Nearest):
+        UNOP(FloatNearest<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Sqrt:
-        CHECK_TRAP(Unop(FloatSqrt<float>));
-        break;
+      CASE(F32Sqrt):
+        UNOP(FloatSqrt<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Eq:
-        CHECK_TRAP(Binop(Eq<float>));
-        break;
+      CASE(F32Eq):
+        BINOP(Eq<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Ne:
-        CHECK_TRAP(Binop(Ne<float>));
-        break;
+      CASE(F32Ne):
+        BINOP(Ne<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Lt:
-        CHECK_TRAP(Binop(Lt<float>));
-        break;
+      CASE(F32Lt):
+        BINOP(Lt<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Le:
-        CHECK_TRAP(Binop(Le<float>));
-        break;
+      CASE(F32Le):
+        BINOP(Le<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Gt:
-        CHECK_TRAP(Binop(Gt<float>));
-        break;
+      CASE(F32Gt):
+        BINOP(Gt<float>);
+        TOS_NEXT();
 
-      case Opcode::F32Ge:
-        CHECK_TRAP(Binop(Ge<float>));
-        break;
+      CASE(F32Ge):
+        BINOP(Ge<float>);
+        TOS_NEXT();
 
-      case Opcode::F64Add:
-        CHECK_TRAP(Binop(Add<double>));
-        break;
+      CASE(F64Add):
+        BINOP(Add<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Sub:
-        CHECK_TRAP(Binop(Sub<double>));
-        break;
+      CASE(F64Sub):
+        BINOP(Sub<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Mul:
-        CHECK_TRAP(Binop(Mul<double>));
-        break;
+      CASE(F64Mul):
+        BINOP(Mul<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Div:
-        CHECK_TRAP(Binop(FloatDiv<double>));
-        break;
+      CASE(F64Div):
+        BINOP(FloatDiv<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Min:
-        CHECK_TRAP(Binop(FloatMin<double>));
-        break;
+      CASE(F64Min):
+        BINOP(FloatMin<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Max:
-        CHECK_TRAP(Binop(FloatMax<double>));
-        break;
+      CASE(F64Max):
+        BINOP(FloatMax<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Abs:
-        CHECK_TRAP(Unop(FloatAbs<double>));
-        break;
+      CASE(F64Abs):
+        UNOP(FloatAbs<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Neg:
-        CHECK_TRAP(Unop(FloatNeg<double>));
-        break;
+      CASE(F64Neg):
+        UNOP(FloatNeg<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Copysign:
-        CHECK_TRAP(Binop(FloatCopySign<double>));
-        break;
+      CASE(F64Copysign):
+        BINOP(FloatCopySign<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Ceil:
-        CHECK_TRAP(Unop(FloatCeil<double>));
-        break;
+      CASE(F64Ceil):
+        UNOP(FloatCeil<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Floor:
-        CHECK_TRAP(Unop(FloatFloor<double>));
-        break;
+      CASE(F64Floor):
+        UNOP(FloatFloor<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Trunc:
-        CHECK_TRAP(Unop(FloatTrunc<double>));
-        break;
+      CASE(F64Trunc):
+        UNOP(FloatTrunc<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Nearest:
-        CHECK_TRAP(Unop(FloatNearest<double>));
-        break;
+      CASE(F64Nearest):
+        UNOP(FloatNearest<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Sqrt:
-        CHECK_TRAP(Unop(FloatSqrt<double>));
-        break;
+      CASE(F64Sqrt):
+        UNOP(FloatSqrt<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Eq:
-        CHECK_TRAP(Binop(Eq<double>));
-        break;
+      CASE(F64Eq):
+        BINOP(Eq<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Ne:
-        CHECK_TRAP(Binop(Ne<double>));
-        break;
+      CASE(F64Ne):
+        BINOP(Ne<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Lt:
-        CHECK_TRAP(Binop(Lt<double>));
-        break;
+      CASE(F64Lt):
+        BINOP(Lt<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Le:
-        CHECK_TRAP(Binop(Le<double>));
-        break;
+      CASE(F64Le):
+        BINOP(Le<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Gt:
-        CHECK_TRAP(Binop(Gt<double>));
-        break;
+      CASE(F64Gt):
+        BINOP(Gt<double>);
+        TOS_NEXT();
 
-      case Opcode::F64Ge:
-        CHECK_TRAP(Binop(Ge<double>));
-        break;
+      CASE(F64Ge):
+        BINOP(Ge<double>);
+        TOS_NEXT();
 
-      case Opcode::I32TruncSF32:
+      CASE(I32TruncSF32):
         CHECK_TRAP(UnopTrap(IntTrunc<int32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncSSatF32:
-        CHECK_TRAP(Unop(IntTruncSat<int32_t, float>));
-        break;
+      CASE(I32TruncSSatF32):
+        UNOP(IntTruncSat<int32_t, float>);
+        TOS_NEXT();
 
-      case Opcode::I32TruncSF64:
+      CASE(I32TruncSF64):
         CHECK_TRAP(UnopTrap(IntTrunc<int32_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncSSatF64:
-        CHECK_TRAP(Unop(IntTruncSat<int32_t, double>));
-        break;
+      CASE(I32TruncSSatF64):
+        UNOP(IntTruncSat<int32_t, double>);
+        TOS_NEXT();
 
-      case Opcode::I32TruncUF32:
+      CASE(I32TruncUF32):
         CHECK_TRAP(UnopTrap(IntTrunc<uint32_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncUSatF32:
-        CHECK_TRAP(Unop(IntTruncSat<uint32_t, float>));
-        break;
+      CASE(I32TruncUSatF32):
+        UNOP(IntTruncSat<uint32_t, float>);
+        TOS_NEXT();
 
-      case Opcode::I32TruncUF64:
+      CASE(I32TruncUF64):
         CHECK_TRAP(UnopTrap(IntTrunc<uint32_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I32TruncUSatF64:
-        CHECK_TRAP(Unop(IntTruncSat<uint32_t, double>));
-        break;
+      CASE(I32TruncUSatF64):
+        UNOP(IntTruncSat<uint32_t, double>);
+        TOS_NEXT();
 
-      case Opcode::I32WrapI64:
+      CASE(I32WrapI64):
         CHECK_TRAP(Push<uint32_t>(Pop<uint64_t>()));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSF32:
+      CASE(I64TruncSF32):
         CHECK_TRAP(UnopTrap(IntTrunc<int64_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSSatF32:
-        CHECK_TRAP(Unop(IntTruncSat<int64_t, float>));
-        break;
+      CASE(I64TruncSSatF32):
+        UNOP(IntTruncSat<int64_t, float>);
+        TOS_NEXT();
 
-      case Opcode::I64TruncSF64:
+      CASE(I64TruncSF64):
         CHECK_TRAP(UnopTrap(IntTrunc<int64_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncSSatF64:
-        CHECK_TRAP(Unop(IntTruncSat<int64_t, double>));
-        break;
+      CASE(I64TruncSSatF64):
+        UNOP(IntTruncSat<int64_t, double>);
+        TOS_NEXT();
 
-      case Opcode::I64TruncUF32:
+      CASE(I64TruncUF32):
         CHECK_TRAP(UnopTrap(IntTrunc<uint64_t, float>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncUSatF32:
-        CHECK_TRAP(Unop(IntTruncSat<uint64_t, float>));
-        break;
+      CASE(I64TruncUSatF32):
+        UNOP(IntTruncSat<uint64_t, float>);
+        TOS_NEXT();
 
-      case Opcode::I64TruncUF64:
+      CASE(I64TruncUF64):
         CHECK_TRAP(UnopTrap(IntTrunc<uint64_t, double>));
-        break;
+        NEXT();
 
-      case Opcode::I64TruncUSatF64:
-        CHECK_TRAP(Unop(IntTruncSat<uint64_t, double>));
-        break;
+      CASE(I64TruncUSatF64):
+        UNOP(IntTruncSat<uint64_t, double>);
+        TOS_NEXT();
 
-      case Opcode::I64ExtendSI32:
+      CASE(I64ExtendSI32):
         CHECK_TRAP(Push<uint64_t>(Pop<int32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::I64ExtendUI32:
+      CASE(I64ExtendUI32):
         CHECK_TRAP(Push<uint64_t>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertSI32:
+      CASE(F32ConvertSI32):
         CHECK_TRAP(Push<float>(Pop<int32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertUI32:
+      CASE(F32ConvertUI32):
         CHECK_TRAP(Push<float>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertSI64:
+      CASE(F32ConvertSI64):
         CHECK_TRAP(Push<float>(Pop<int64_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F32ConvertUI64:
+      CASE(F32ConvertUI64):
         CHECK_TRAP(Push<float>(wabt_convert_uint64_to_float(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F32DemoteF64: {
+      CASE(F32DemoteF64): {
         typedef FloatTraits<float> F32Traits;
         typedef FloatTraits<double> F64Traits;
 
@@ -2169,146 +2807,238 @@ Result Thread::Run(int num_instructions) {
           }
           CHECK_TRAP(PushRep<float>(sign | F32Traits::kInf | tag));
         }
-        break;
+        NEXT();
       }
 
-      case Opcode::F32ReinterpretI32:
+      CASE(F32ReinterpretI32):
         CHECK_TRAP(PushRep<float>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertSI32:
+      CASE(F64ConvertSI32):
         CHECK_TRAP(Push<double>(Pop<int32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertUI32:
+      CASE(F64ConvertUI32):
         CHECK_TRAP(Push<double>(Pop<uint32_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertSI64:
+      CASE(F64ConvertSI64):
         CHECK_TRAP(Push<double>(Pop<int64_t>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ConvertUI64:
+      CASE(F64ConvertUI64):
         CHECK_TRAP(
             Push<double>(wabt_convert_uint64_to_double(Pop<uint64_t>())));
-        break;
+        NEXT();
 
-      case Opcode::F64PromoteF32:
+      CASE(F64PromoteF32):
         CHECK_TRAP(Push<double>(Pop<float>()));
-        break;
+        NEXT();
 
-      case Opcode::F64ReinterpretI64:
+      CASE(F64ReinterpretI64):
         CHECK_TRAP(PushRep<double>(Pop<uint64_t>()));
-        break;
+        NEXT();
 
-      case Opcode::I32ReinterpretF32:
+      CASE(I32ReinterpretF32):
         CHECK_TRAP(Push<uint32_t>(PopRep<float>()));
-        break;
+        NEXT();
 
-      case Opcode::I64ReinterpretF64:
+      CASE(I64ReinterpretF64):
         CHECK_TRAP(Push<uint64_t>(PopRep<double>()));
-        break;
+        NEXT();
 
-      case Opcode::I32Rotr:
-        CHECK_TRAP(Binop(IntRotr<uint32_t>));
-        break;
+      CASE(I32Rotr):
+        BINOP(IntRotr<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Rotl:
-        CHECK_TRAP(Binop(IntRotl<uint32_t>));
-        break;
+      CASE(I32Rotl):
+        BINOP(IntRotl<uint32_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Rotr:
-        CHECK_TRAP(Binop(IntRotr<uint64_t>));
-        break;
+      CASE(I64Rotr):
+        BINOP(IntRotr<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Rotl:
-        CHECK_TRAP(Binop(IntRotl<uint64_t>));
-        break;
+      CASE(I64Rotl):
+        BINOP(IntRotl<uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Eqz:
-        CHECK_TRAP(Unop(IntEqz<uint32_t, uint64_t>));
-        break;
+      CASE(I64Eqz):
+        UNOP(IntEqz<uint32_t, uint64_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Extend8S:
-        CHECK_TRAP(Unop(IntExtendS<uint32_t, int8_t>));
-        break;
+      CASE(I32Extend8S):
+        UNOP(IntExtendS<uint32_t, int8_t>);
+        TOS_NEXT();
 
-      case Opcode::I32Extend16S:
-        CHECK_TRAP(Unop(IntExtendS<uint32_t, int16_t>));
-        break;
+      CASE(I32Extend16S):
+        UNOP(IntExtendS<uint32_t, int16_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Extend8S:
-        CHECK_TRAP(Unop(IntExtendS<uint64_t, int8_t>));
-        break;
+      CASE(I64Extend8S):
+        UNOP(IntExtendS<uint64_t, int8_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Extend16S:
-        CHECK_TRAP(Unop(IntExtendS<uint64_t, int16_t>));
-        break;
+      CASE(I64Extend16S):
+        UNOP(IntExtendS<uint64_t, int16_t>);
+        TOS_NEXT();
 
-      case Opcode::I64Extend32S:
-        CHECK_TRAP(Unop(IntExtendS<uint64_t, int32_t>));
-        break;
+      CASE(I64Extend32S):
+        UNOP(IntExtendS<uint64_t, int32_t>);
+        TOS_NEXT();
 
-      case Opcode::InterpAlloca: {
+      CASE(InterpAlloca): {
         uint32_t old_value_stack_top = value_stack_top_;
         size_t count = ReadU32(&pc);
         value_stack_top_ += count;
         CHECK_STACK();
         memset(&value_stack_[old_value_stack_top], 0, count * sizeof(Value));
-        break;
+        NEXT();
       }
 
-      case Opcode::InterpBrUnless: {
+      CASE(InterpBrUnless): {
         IstreamOffset new_pc = ReadU32(&pc);
+        if (kCacheTos) {
+          uint32_t cond = GetValue<uint32_t>(tos);
+          --value_stack_top_;
+          tos = FillTos();
+          if (!cond)
+            GOTO(new_pc);
+          TOS_NEXT();
+        }
         if (!Pop<uint32_t>())
           GOTO(new_pc);
-        break;
+        NEXT();
       }
 
-      case Opcode::Drop:
+      CASE(Drop):
+        if (kCacheTos) {
+          --value_stack_top_;
+          tos = FillTos();
+          TOS_NEXT();
+        }
         (void)Pop();
-        break;
+        NEXT();
 
-      case Opcode::InterpDropKeep: {
+      CASE(InterpDropKeep): {
         uint32_t drop_count = ReadU32(&pc);
         uint8_t keep_count = *pc++;
         DropKeep(drop_count, keep_count);
-        break;
+        NEXT();
       }
 
-      case Opcode::Nop:
-        break;
+      CASE(InterpGetLocalGetLocal): {
+        if (kCacheTos) {
+          CHECK_TRAP(PushTos(tos));
+          tos = Local(ReadU32(&pc));
+          CHECK_TRAP(PushTos(tos));
+          tos = Local(ReadU32(&pc));
+          TOS_NEXT();
+        }
+        CHECK_TRAP(Push(Local(ReadU32(&pc))));
+        CHECK_TRAP(Push(Local(ReadU32(&pc))));
+        NEXT();
+      }
 
-      case Opcode::I32Wait:
-      case Opcode::I64Wait:
-      case Opcode::Wake:
+      CASE(InterpGetLocalGetLocalI32Add): {
+        if (kCacheTos) {
+          CHECK_TRAP(PushTos(tos));
+          uint32_t lhs = Local(ReadU32(&pc)).i32;
+          uint32_t rhs = Local(ReadU32(&pc)).i32;
+          tos = MakeValue<uint32_t>(Add<uint32_t>(lhs, rhs));
+          TOS_NEXT();
+        }
+        uint32_t lhs = Local(ReadU32(&pc)).i32;
+        uint32_t rhs = Local(ReadU32(&pc)).i32;
+        CHECK_TRAP(Push<uint32_t>(Add<uint32_t>(lhs, rhs)));
+        NEXT();
+      }
+
+      CASE(InterpGetLocalI32Const): {
+        if (kCacheTos) {
+          CHECK_TRAP(PushTos(tos));
+          tos = Local(ReadU32(&pc));
+          CHECK_TRAP(PushTos(tos));
+          tos = MakeValue<uint32_t>(ReadU32(&pc));
+          TOS_NEXT();
+        }
+        CHECK_TRAP(Push(Local(ReadU32(&pc))));
+        CHECK_TRAP(Push<uint32_t>(ReadU32(&pc)));
+        NEXT();
+      }
+
+      CASE(InterpGetLocalI32ConstI32Add): {
+        if (kCacheTos) {
+          CHECK_TRAP(PushTos(tos));
+          uint32_t lhs = Local(ReadU32(&pc)).i32;
+          tos = MakeValue<uint32_t>(Add<uint32_t>(lhs, ReadU32(&pc)));
+          TOS_NEXT();
+        }
+        uint32_t lhs = Local(ReadU32(&pc)).i32;
+        uint32_t rhs = ReadU32(&pc);
+        CHECK_TRAP(Push<uint32_t>(Add<uint32_t>(lhs, rhs)));
+        NEXT();
+      }
+
+      CASE(Nop):
+        NEXT();
+
+      CASE(I32Wait):
+      CASE(I64Wait):
+      CASE(Wake):
         // TODO(binji): Implement.
         TRAP(Unreachable);
-        break;
+        NEXT();
 
       // The following opcodes are either never generated or should never be
       // executed.
-      case Opcode::Block:
-      case Opcode::Catch:
-      case Opcode::CatchAll:
-      case Opcode::Else:
-      case Opcode::End:
-      case Opcode::If:
-      case Opcode::InterpData:
-      case Opcode::Invalid:
-      case Opcode::Loop:
-      case Opcode::Rethrow:
-      case Opcode::Throw:
-      case Opcode::Try:
+      CASE(Block):
+      CASE(Catch):
+      CASE(CatchAll):
+      CASE(Else):
+      CASE(End):
+      CASE(If):
+      CASE(InterpData):
+      CASE(Invalid):
+      CASE(Loop):
+      CASE(Rethrow):
+      CASE(Throw):
+      CASE(Try):
         WABT_UNREACHABLE;
-        break;
+        NEXT();
+
+#if WABT_THREADED_DISPATCH
+        // Entry points of the handlers that don't know about |tos|, used by
+        // kTosHandlers.
+#define WABT_OPCODE(rtype, type1, type2, type3, mem_size, prefix, code, Name, \
+                    text)                                                     \
+  spill_##Name:                                                               \
+  SpillTos(tos);                                                              \
+  goto op_##Name;
+#include "src/opcode.def"
+#undef WABT_OPCODE
+#endif
     }
   }
 
+  // Only reached with switch dispatch, where the loop ends with |tos| live.
+  if (kCacheTos) {
+    SpillTos(tos);
+  }
+
 exit_loop:
   return result;
 }
 
+#undef CASE
+#undef DISPATCH
+#undef NEXT
+#undef TOS_NEXT
+#undef BINOP
+#undef BINOP_TRAP
+#undef UNOP
+#undef PUSH_REP
+
 void Thread::Trace(Stream* stream) {
   const uint8_t* istream = GetIstream();
   const uint8_t* pc = &istream[pc_];
@@ -2376,13 +3106,21 @@ void Thread::Trace(Stream* stream) {
       break;
 
     case Opcode::GetLocal:
+      stream->Writef("%s $%d\n", opcode.GetName(),
+                     static_cast<int32_t>(ReadU32At(pc)));
+      break;
+
     case Opcode::GetGlobal:
       stream->Writef("%s $%u\n", opcode.GetName(), ReadU32At(pc));
       break;
 
     case Opcode::SetLocal:
-    case Opcode::SetGlobal:
     case Opcode::TeeLocal:
+      stream->Writef("%s $%d, %u\n", opcode.GetName(),
+                     static_cast<int32_t>(ReadU32At(pc)), Top().i32);
+      break;
+
+    case Opcode::SetGlobal:
       stream->Writef("%s $%u, %u\n", opcode.GetName(), ReadU32At(pc),
                      Top().i32);
       break;
@@ -2575,7 +3313,8 @@ void Thread::Trace(Stream* stream) {
     case Opcode::I32GeU:
     case Opcode::I32Rotr:
     case Opcode::I32Rotl:
-      stream->Writef("%s %u, %u\n", opcode.GetName(), Pick(2).i32, Pick(1).i32);
+      stream->Writef("%s %u, %u\n", opcode.GetName(), BinopLhs(pc).i32,
+                     BinopRhs(pc).i32);
       break;
 
     case Opcode::I32Clz:
@@ -2613,7 +3352,7 @@ void Thread::Trace(Stream* stream) {
     case Opcode::I64Rotr:
     case Opcode::I64Rotl:
       stream->Writef("%s %" PRIu64 ", %" PRIu64 "\n", opcode.GetName(),
-                     Pick(2).i64, Pick(1).i64);
+                     BinopLhs(pc).i64, BinopRhs(pc).i64);
       break;
 
     case Opcode::I64Clz:
@@ -2640,7 +3379,8 @@ void Thread::Trace(Stream* stream) {
     case Opcode::F32Gt:
     case Opcode::F32Ge:
       stream->Writef("%s %g, %g\n", opcode.GetName(),
-                     Bitcast<float>(Pick(2).i32), Bitcast<float>(Pick(1).i32));
+                     Bitcast<float>(BinopLhs(pc).i32),
+                     Bitcast<float>(BinopRhs(pc).i32));
       break;
 
     case Opcode::F32Abs:
@@ -2667,8 +3407,8 @@ void Thread::Trace(Stream* stream) {
     case Opcode::F64Gt:
     case Opcode::F64Ge:
       stream->Writef("%s %g, %g\n", opcode.GetName(),
-                     Bitcast<double>(Pick(2).i64),
-                     Bitcast<double>(Pick(1).i64));
+                     Bitcast<double>(BinopLhs(pc).i64),
+                     Bitcast<double>(BinopRhs(pc).i64));
       break;
 
     case Opcode::F64Abs:
@@ -2740,6 +3480,19 @@ void Thread::Trace(Stream* stream) {
                      *(pc + 4));
       break;
 
+    case Opcode::InterpGetLocalGetLocal:
+    case Opcode::InterpGetLocalGetLocalI32Add:
+      stream->Writef("%s $%d, $%d\n", opcode.GetName(),
+                     static_cast<int32_t>(ReadU32At(pc)),
+                     static_cast<int32_t>(ReadU32At(pc + 4)));
+      break;
+
+    case Opcode::InterpGetLocalI32Const:
+    case Opcode::InterpGetLocalI32ConstI32Add:
+      stream->Writef("%s $%d, $%u\n", opcode.GetName(),
+                     static_cast<int32_t>(ReadU32At(pc)), ReadU32At(pc + 4));
+      break;
+
     // The following opcodes are either never generated or should never be
     // executed.
     case Opcode::Block:
@@ -2828,13 +3581,21 @@ void Environment::Disassemble(Stream* stream,
         break;
 
       case Opcode::GetLocal:
+        stream->Writef("%s $%d\n", opcode.GetName(),
+                       static_cast<int32_t>(ReadU32(&pc)));
+        break;
+
       case Opcode::GetGlobal:
         stream->Writef("%s $%u\n", opcode.GetName(), ReadU32(&pc));
         break;
 
       case Opcode::SetLocal:
-      case Opcode::SetGlobal:
       case Opcode::TeeLocal:
+        stream->Writef("%s $%d, %%[-1]\n", opcode.GetName(),
+                       static_cast<int32_t>(ReadU32(&pc)));
+        break;
+
+      case Opcode::SetGlobal:
         stream->Writef("%s $%u, %%[-1]\n", opcode.GetName(), ReadU32(&pc));
         break;
 
@@ -3036,7 +3797,20 @@ void Environment::Disassemble(Stream* stream,
       case Opcode::F64Le:
       case Opcode::F64Gt:
       case Opcode::F64Ge:
-        stream->Writef("%s %%[-2], %%[-1]\n", opcode.GetName());
+        if (register_istream) {
+          uint32_t lhs = ReadU32(&pc);
+          uint32_t rhs = ReadU32(&pc);
+          uint32_t dest = ReadU32(&pc);
+          uint8_t drop = ReadU8(&pc);
+          stream->Writef("%s %%[-%u], %%[-%u], drop:%u", opcode.GetName(), lhs,
+                         rhs, drop);
+          if (dest != 0) {
+            stream->Writef(" => %%[-%u]", dest);
+          }
+          stream->Writef("\n");
+        } else {
+          stream->Writef("%s %%[-2], %%[-1]\n", opcode.GetName());
+        }
         break;
 
       case Opcode::I32Clz:
@@ -3124,6 +3898,22 @@ void Environment::Disassemble(Stream* stream,
         break;
       }
 
+      case Opcode::InterpGetLocalGetLocal:
+      case Opcode::InterpGetLocalGetLocalI32Add: {
+        int32_t first = ReadU32(&pc);
+        int32_t second = ReadU32(&pc);
+        stream->Writef("%s $%d, $%d\n", opcode.GetName(), first, second);
+        break;
+      }
+
+      case Opcode::InterpGetLocalI32Const:
+      case Opcode::InterpGetLocalI32ConstI32Add: {
+        int32_t local = ReadU32(&pc);
+        uint32_t value = ReadU32(&pc);
+        stream->Writef("%s $%d, $%u\n", opcode.GetName(), local, value);
+        break;
+      }
+
       case Opcode::InterpData: {
         uint32_t num_bytes = ReadU32(&pc);
         stream->Writef("%s $%u\n", opcode.GetName(), num_bytes);
@@ -3224,7 +4014,9 @@ ExecResult Executor::RunFunction(Index func_index, const TypedValues& args) {
       CopyResults(sig, &exec_result.values);
   }
 
-  exec_result.call_stack.assign(thread_.call_stack_.begin(), thread_.call_stack_.begin() + thread_.call_stack_top_);
+  for (Index i = 0; i < thread_.call_stack_top_; ++i) {
+    exec_result.call_stack.push_back(thread_.call_stack_[i].return_offset);
+  }
   exec_result.call_stack.push_back(thread_.pc_);
 
   thread_.Reset();
@@ -3268,6 +4060,7 @@ ExecResult Executor::RunExportByName(Module* module,
 
 Result Executor::RunDefinedFunction(IstreamOffset function_offset) {
   Result result = Result::Ok;
+  thread_.frame_base_ = thread_.value_stack_top_;
   thread_.set_pc(function_offset);
   if (trace_stream_) {
     const int kNumInstructions = 1;
@@ -19,14 +19,20 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <functional>
+#include <map>
 #include <memory>
+#include <tuple>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 
+#include "src/jit/background-compiler.h"
 #include "src/jit/environment.h"
 #include "src/binding-hash.h"
 #include "src/common.h"
+#include "src/interp-memory.h"
 #include "src/opcode.h"
 #include "src/stream.h"
 
@@ -34,6 +40,7 @@ namespace wabt {
 
 namespace jit {
 class FunctionBuilder;
+class TypeDictionary;
 }
 
 namespace interp {
@@ -110,23 +117,37 @@ struct FuncSignature {
 
   std::vector<Type> param_types;
   std::vector<Type> result_types;
+
+  // Index of the first signature of the environment with the same types, so
+  // signatures can be compared by this index alone.
+  Index canonical_index = kInvalidIndex;
 };
 
 struct Table {
   explicit Table(const Limits& limits)
-      : limits(limits), func_indexes(limits.initial, kInvalidIndex) {}
+      : limits(limits),
+        func_indexes(limits.initial, kInvalidIndex),
+        canonical_sig_indexes(limits.initial, kInvalidIndex) {}
+
+  void SetEntry(Index entry_index, Index func_index, Index canonical_sig_index) {
+    func_indexes[entry_index] = func_index;
+    canonical_sig_indexes[entry_index] = canonical_sig_index;
+  }
 
   Limits limits;
   std::vector<Index> func_indexes;
+  // The canonical signature index of each entry's function, so call_indirect
+  // can check the signature without looking up the function.
+  std::vector<Index> canonical_sig_indexes;
 };
 
 struct Memory {
   Memory() = default;
-  explicit Memory(const Limits& limits)
-      : page_limits(limits), data(limits.initial * WABT_PAGE_SIZE) {}
+  explicit Memory(const Limits& limits, bool guarded = false)
+      : page_limits(limits), data(limits.initial * WABT_PAGE_SIZE, guarded) {}
 
   Limits page_limits;
-  std::vector<char> data;
+  MemoryData data;
 };
 
 // ValueTypeRep converts from one type to its representation on the
@@ -247,6 +268,7 @@ struct DefinedFunc : Func {
   DefinedFunc(Index sig_index)
       : Func(sig_index, false),
         offset(kInvalidIstreamOffset),
+        size(0),
         local_decl_count(0),
         local_count(0) {}
 
@@ -256,6 +278,8 @@ struct DefinedFunc : Func {
   bool has_dbg_name_ = false;
 
   IstreamOffset offset;
+  // Size of the function's code in the istream, once it has been read
+  IstreamOffset size;
   Index local_decl_count;
   Index local_count;
   std::vector<Type> param_and_local_types;
@@ -358,6 +382,22 @@ class Environment {
   bool enable_jit = true;
   bool trap_on_failed_comp = false;
   uint32_t jit_threshold = 1;
+  // Compile functions on a background thread and keep interpreting them until
+  // their compiled code is ready, instead of compiling on the calling thread.
+  bool background_jit = false;
+  // Number of times a loop must be branched back to before its function is
+  // compiled for on-stack replacement at the loop header, 0 to disable it.
+  uint32_t osr_threshold = 1000;
+  // Number of calls and loop iterations of a compiled function after which it
+  // is recompiled with more optimizations, 0 to never recompile.
+  uint32_t jit_tier2_threshold = 0;
+  // Allocate memories defined by modules with guard pages instead of
+  // bounds-checking each access. Ignored if unsupported on this platform.
+  bool guard_page_memory = false;
+  // Translate functions to a register-style istream, where binary operators
+  // read locals in place and may store their result directly to a local. Must
+  // be set before any module is loaded into the environment.
+  bool register_istream = false;
 
   Environment();
 
@@ -410,7 +450,9 @@ class Environment {
   template <typename... Args>
   FuncSignature* EmplaceBackFuncSignature(Args&&... args) {
     sigs_.emplace_back(std::forward<Args>(args)...);
-    return &sigs_.back();
+    FuncSignature* sig = &sigs_.back();
+    sig->canonical_index = InternFuncSignature(*sig, sigs_.size() - 1);
+    return sig;
   }
 
   template <typename... Args>
@@ -421,9 +463,27 @@ class Environment {
 
   void AddJitMetadata(DefinedFunc* fn) {
     assert(fn->offset != kInvalidIstreamOffset);
-    this->jit_meta_.insert({ fn->offset, JitMeta(fn) });
+    this->jit_meta_.emplace(fn->offset, fn);
+  }
+
+  void AddOsrMetadata(DefinedFunc* fn, IstreamOffset loop_offset) {
+    this->osr_meta_.emplace(std::piecewise_construct,
+                            std::forward_as_tuple(loop_offset),
+                            std::forward_as_tuple(fn, loop_offset));
   }
 
+  // Block until all pending background compilations are done. They read the
+  // environment without locking, so this must be called before modifying it.
+  void WaitForBackgroundJit() { background_compiler_.Wait(); }
+
+  // Compile all functions that have not been compiled yet. Returns the number
+  // of functions compiled.
+  Index JitCompileAll();
+
+  // Forget the targets cached by the call_indirects of JITed code. Must be
+  // called whenever a table entry changes.
+  void ClearCallIndirectCaches();
+
   template <typename... Args>
   Global* EmplaceBackGlobal(Args&&... args) {
     globals_.emplace_back(std::forward<Args>(args)...);
@@ -471,22 +531,67 @@ class Environment {
  private:
   friend class Thread;
   friend class wabt::jit::FunctionBuilder;
-  using JITedFunction = wabt::interp::Result (*)();
+  using JITedFunction = wabt::interp::Result (*)(Thread*);
 
   struct JitMeta {
     DefinedFunc* wasm_fn;
-    uint32_t num_calls = 0;
-
-    bool tried_jit = false;
-    JITedFunction jit_fn = nullptr;
+    // The loop header the function is entered at, for on-stack replacement
+    IstreamOffset osr_offset;
+    // Number of calls, or of iterations of the loop for on-stack replacement.
+    // Every thread running the function counts, so the count and the request
+    // to compile it are atomic.
+    std::atomic<uint32_t> num_calls{0};
+    std::atomic<bool> jit_requested{false};
+
+    // Calls and loop iterations counted by the tier 1 code of the function.
+    // Several threads may find it hot at once, so the request to recompile it
+    // is set atomically. JITed code loads it directly, so it must have the
+    // layout of a plain bool.
+    uint32_t hotness = 0;
+    std::atomic<bool> tier_up_requested{false};
+
+    // Written by the background compiler while the function runs, so both are
+    // atomic. jit_fn is published before compiled is set. JITed callers load
+    // jit_fn directly, so it must have the layout of a plain pointer.
+    std::atomic<JITedFunction> jit_fn{nullptr};
+    std::atomic<bool> compiled{false};
+
+    JitMeta(DefinedFunc* wasm_fn, IstreamOffset osr_offset = kInvalidIstreamOffset)
+        : wasm_fn(wasm_fn), osr_offset(osr_offset) {}
+  };
 
-    JitMeta(DefinedFunc* wasm_fn) : wasm_fn(wasm_fn) {}
+  Index InternFuncSignature(const FuncSignature& sig, Index sig_index);
+
+  void Compile(JitMeta* meta);
+  // Count a call or loop iteration, compiling once threshold is reached
+  void CountUse(JitMeta* meta, uint32_t threshold);
+  // Recompile a function whose tier 1 code became hot
+  void TierUp(JitMeta* meta);
+
+  // The targets of a call_indirect of JITed code, by table entry. Each slot is
+  // only filled once, its entry being published after its target, so JITed
+  // code reads the slots without locking. It loads them directly, so they must
+  // have the layout of plain values. A target is the jit_fn of the callee's
+  // JIT metadata rather than its value, so calls follow the callee when it is
+  // recompiled.
+  struct CallIndirectCache {
+    static const Index kNumSlots = 4;
+
+    struct Slot {
+      std::atomic<Index> entry_index{kInvalidIndex};
+      std::atomic<std::atomic<JITedFunction>*> jit_fn{nullptr};
+    };
+
+    Slot slots[kNumSlots];
   };
 
-  bool TryJit(Thread* t, IstreamOffset offset, JITedFunction* fn);
+  bool TryJit(IstreamOffset offset, JITedFunction* fn);
+  bool TryOsr(IstreamOffset loop_offset, JITedFunction* fn);
 
   std::vector<std::unique_ptr<Module>> modules_;
   std::vector<FuncSignature> sigs_;
+  // Canonical index of the signatures, by param and result types
+  std::map<std::pair<std::vector<Type>, std::vector<Type>>, Index> canonical_sigs_;
   std::vector<std::unique_ptr<Func>> funcs_;
   std::vector<Memory> memories_;
   std::vector<Table> tables_;
@@ -497,8 +602,21 @@ class Environment {
 
   jit::JitEnvironment jit_env_;
   std::unordered_map<IstreamOffset, JitMeta> jit_meta_;
+  // Keyed by loop header. Filled when the functions are loaded, so running
+  // threads only look entries up.
+  std::unordered_map<IstreamOffset, JitMeta> osr_meta_;
+  // Keyed by the istream offset of the call_indirect, so all compilations of
+  // a call site share its cache. JITed code refers to the caches by address,
+  // which unordered_map keeps stable.
+  std::unordered_map<IstreamOffset, CallIndirectCache> call_indirect_caches_;
+
+  // Declared last, so pending compilations are stopped before anything they
+  // use is destroyed
+  jit::BackgroundCompiler background_compiler_;
 };
 
+class TempPc;
+
 class Thread {
  public:
   struct Options {
@@ -510,6 +628,9 @@ class Thread {
 
     uint32_t value_stack_size;
     uint32_t call_stack_size;
+    // Keep the value at the top of the value stack in a register while
+    // running the interpreter. Ignored for register istreams.
+    bool cache_top_of_stack = false;
   };
 
   explicit Thread(Environment*, const Options& = Options());
@@ -532,6 +653,7 @@ class Thread {
 
  private:
   friend class wabt::jit::FunctionBuilder;
+  friend class wabt::jit::TypeDictionary;
   friend class Executor;
   const uint8_t* GetIstream() const { return env_->istream_->data.data(); }
 
@@ -543,6 +665,8 @@ class Thread {
 
   Value& Top();
   Value& Pick(Index depth);
+  // The param or local at |offset| from the frame base, see call_stack_.
+  Value& Local(Index offset);
 
   // Push/Pop values with conversions, e.g. Push<float> will convert to the
   // ValueTypeRep (uint32_t) and push that. Similarly, Pop<float> will pop the
@@ -564,6 +688,7 @@ class Thread {
 
   Result PushCall(const uint8_t* pc) WABT_WARN_UNUSED;
   IstreamOffset PopCall();
+  Result CallJITed(Environment::JITedFunction fn) WABT_WARN_UNUSED;
 
   template <typename R, typename T> using UnopFunc      = R(T);
   template <typename R, typename T> using UnopTrapFunc  = Result(T, R*);
@@ -594,13 +719,57 @@ class Thread {
   template <typename R, typename T = R>
   Result BinopTrap(BinopTrapFunc<R, T> func) WABT_WARN_UNUSED;
 
+  // Binary operators of a register istream.
+  template <typename R, typename T = R>
+  Result RegisterBinop(BinopFunc<R, T> func,
+                       const uint8_t* operands) WABT_WARN_UNUSED;
+  template <typename R, typename T = R>
+  Result RegisterBinopTrap(BinopTrapFunc<R, T> func,
+                           const uint8_t* operands) WABT_WARN_UNUSED;
+  template <typename R>
+  Result StoreRegisterResult(ValueTypeRep<R> value,
+                             const uint8_t* operands) WABT_WARN_UNUSED;
+
+  // Top-of-stack caching (see Thread::RunIstream).
+  template <typename R, typename T = R>
+  Value TosUnop(UnopFunc<R, T> func, Value value);
+  template <typename R, typename T = R>
+  Value TosBinop(BinopFunc<R, T> func, Value rhs);
+  Result PushTos(Value tos) WABT_WARN_UNUSED;
+  void SpillTos(Value tos);
+  Value FillTos();
+
+  template <bool kRegisterIstream, bool kCacheTos>
+  Result RunIstream(int num_instructions, TempPc* tpc);
+
+  // The values of the operands of the binary operator at |pc|, which points
+  // just after its opcode.
+  Value& BinopLhs(const uint8_t* pc);
+  Value& BinopRhs(const uint8_t* pc);
+
+  // An entry of the call stack.
+  struct CallFrame {
+    IstreamOffset return_offset;
+    uint32_t frame_base;  // of the caller
+  };
+
   Environment* env_ = nullptr;
   std::vector<Value> value_stack_;
-  std::vector<IstreamOffset> call_stack_;
+  // The frame base of a call is the height of the value stack when it is made,
+  // so the params are just below it and the locals just above it.
+  std::vector<CallFrame> call_stack_;
+  // The stacks are never resized. JITed code is shared by all threads and
+  // reaches them through these plain fields, as it can't look inside a vector.
+  Value* value_stack_data_ = nullptr;
+  uint32_t value_stack_size_ = 0;
+  CallFrame* call_stack_data_ = nullptr;
+  uint32_t call_stack_size_ = 0;
   uint32_t value_stack_top_ = 0;
   uint32_t call_stack_top_ = 0;
+  uint32_t frame_base_ = 0;
   uint32_t last_jit_frame_ = 0;
   IstreamOffset pc_ = 0;
+  bool cache_top_of_stack_ = false;
 };
 
 struct ExecResult {
@@ -644,6 +813,14 @@ bool IsCanonicalNan(uint64_t f64_bits);
 bool IsArithmeticNan(uint32_t f32_bits);
 bool IsArithmeticNan(uint64_t f64_bits);
 
+// Whether |opcode| is a binary operator, including comparisons. In a register
+// istream, these are followed by the depths of their two operands (u32 each),
+// the depth of the local to store the result to (u32, 0 to push it instead)
+// and the number of operands to drop from the stack (u8). The operand depths
+// are relative to the stack before the instruction, the destination depth to
+// the stack after the drop.
+bool IsRegisterBinop(Opcode);
+
 std::string TypedValueToString(const TypedValue&);
 const char* ResultToString(Result);
 
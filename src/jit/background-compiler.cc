@@ -0,0 +1,81 @@
+/*
+ * Copyright 2018 wasmjit-omr project participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "background-compiler.h"
+
+#include <utility>
+
+namespace wabt {
+namespace jit {
+
+BackgroundCompiler::~BackgroundCompiler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  job_available_.notify_one();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void BackgroundCompiler::Enqueue(Job job) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    jobs_.push_back(std::move(job));
+
+    if (!thread_.joinable()) {
+      thread_ = std::thread(&BackgroundCompiler::Run, this);
+    }
+  }
+  job_available_.notify_one();
+}
+
+void BackgroundCompiler::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this]() { return jobs_.empty() && !busy_; });
+}
+
+void BackgroundCompiler::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (true) {
+    job_available_.wait(lock, [this]() { return stopping_ || !jobs_.empty(); });
+
+    // Pending jobs are dropped on shutdown, the functions they would have
+    // compiled are going away with the environment.
+    if (stopping_) {
+      return;
+    }
+
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+    busy_ = true;
+
+    lock.unlock();
+    job();
+    lock.lock();
+
+    busy_ = false;
+    if (jobs_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
+
+}
+}
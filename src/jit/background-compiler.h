@@ -0,0 +1,71 @@
+/*
+ * Copyright 2018 wasmjit-omr project participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BACKGROUNDCOMPILER_HPP
+#define BACKGROUNDCOMPILER_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace wabt {
+namespace jit {
+
+/**
+ * @brief A queue of compilations serviced by a dedicated thread
+ *
+ * Jobs run one at a time, in the order they were enqueued, so JitBuilder never
+ * has to compile two functions at once. The thread is only started when the
+ * first job is enqueued.
+ */
+class BackgroundCompiler {
+ public:
+  using Job = std::function<void()>;
+
+  BackgroundCompiler() = default;
+  ~BackgroundCompiler();
+
+  BackgroundCompiler(const BackgroundCompiler&) = delete;
+  BackgroundCompiler& operator=(const BackgroundCompiler&) = delete;
+
+  void Enqueue(Job job);
+
+  /**
+   * @brief Block until all enqueued jobs have finished running
+   *
+   * Jobs read the environment without locking, so this must be called before
+   * anything they may read is modified (e.g. before loading another module).
+   */
+  void Wait();
+
+ private:
+  void Run();
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable job_available_;
+  std::condition_variable idle_;
+  std::deque<Job> jobs_;
+  bool busy_ = false;
+  bool stopping_ = false;
+};
+
+}
+}
+
+#endif // BACKGROUNDCOMPILER_HPP
@@ -24,7 +24,7 @@ unsigned short JitEnvironment::instance_count_ = 0;
 
 JitEnvironment::JitEnvironment() {
   if (instance_count_ == 0)
-     initializeJit();
+     initializeJitWithOptions(const_cast<char*>("-Xjit:{*" JIT_TIER2_NAME_SUFFIX "}(optLevel=hot)"));
   ++instance_count_;
 }
 
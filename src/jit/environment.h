@@ -17,6 +17,10 @@
 #ifndef JIT_ENVIRONMENT_HPP
 #define JIT_ENVIRONMENT_HPP
 
+// Suffix of the names given to functions compiled for tier 2, which the JIT is
+// configured to compile at a higher optimization level
+#define JIT_TIER2_NAME_SUFFIX "@tier2"
+
 namespace wabt {
 namespace jit {
 
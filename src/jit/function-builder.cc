@@ -23,6 +23,7 @@
 
 #include <cmath>
 #include <limits>
+#include <mutex>
 #include <type_traits>
 
 namespace wabt {
@@ -77,6 +78,32 @@ inline Opcode ReadOpcodeAt(const uint8_t* pc) {
   return ReadOpcode(&pc);
 }
 
+// Names of the atomic helpers, indexed by AtomicRmwOp and by log2 of the access size
+const char* const kAtomicRmwHelperNames[][4] = {
+  {"atomic_add_8", "atomic_add_16", "atomic_add_32", "atomic_add_64"},
+  {"atomic_sub_8", "atomic_sub_16", "atomic_sub_32", "atomic_sub_64"},
+  {"atomic_and_8", "atomic_and_16", "atomic_and_32", "atomic_and_64"},
+  {"atomic_or_8", "atomic_or_16", "atomic_or_32", "atomic_or_64"},
+  {"atomic_xor_8", "atomic_xor_16", "atomic_xor_32", "atomic_xor_64"},
+  {"atomic_xchg_8", "atomic_xchg_16", "atomic_xchg_32", "atomic_xchg_64"},
+};
+const char* const kAtomicCmpxchgHelperNames[] = {
+  "atomic_cmpxchg_8", "atomic_cmpxchg_16", "atomic_cmpxchg_32", "atomic_cmpxchg_64",
+};
+const char* const kAtomicStoreHelperNames[] = {
+  "atomic_store_8", "atomic_store_16", "atomic_store_32", "atomic_store_64",
+};
+
+// Limits on inlining: the size of the callee's code in the istream and the
+// number of nested inlined calls
+const interp::IstreamOffset kMaxInlineSize = 128;
+const Index kMaxInlineDepth = 3;
+
+template <typename MemType>
+constexpr int AtomicHelperIndex() {
+  return sizeof(MemType) == 1 ? 0 : sizeof(MemType) == 2 ? 1 : sizeof(MemType) == 4 ? 2 : 3;
+}
+
 #define CHECK_TRAP_IN_HELPER(...)                \
   do {                                           \
     wabt::interp::Result result = (__VA_ARGS__); \
@@ -93,9 +120,6 @@ inline Opcode ReadOpcodeAt(const uint8_t* pc) {
   } while (0)
 
 FunctionBuilder::Result_t FunctionBuilder::CallHelper(wabt::interp::Thread* th, wabt::interp::IstreamOffset offset, uint8_t* current_pc) {
-  // no need to check if JIT was enabled since we can only get here it was
-  auto meta_it = th->env_->jit_meta_.find(offset);
-
   auto call_interp = [&]() {
     th->set_pc(offset);
     auto last_jit_frame = th->last_jit_frame_;
@@ -109,27 +133,10 @@ FunctionBuilder::Result_t FunctionBuilder::CallHelper(wabt::interp::Thread* th,
   };
 
   CHECK_TRAP_IN_HELPER(th->PushCall(current_pc));
-  if (meta_it != th->env_->jit_meta_.end()) {
-    auto meta = &meta_it->second;
-    if (!meta->tried_jit) {
-      meta->num_calls++;
-
-      if (meta->num_calls >= th->env_->jit_threshold) {
-        meta->jit_fn = jit::compile(th, meta->wasm_fn);
-        meta->tried_jit = true;
-
-        if (th->env_->trap_on_failed_comp && meta->jit_fn == nullptr)
-          return static_cast<Result_t>(wabt::interp::Result::TrapFailedJITCompilation);
-      }
-    }
-
-    if (meta->jit_fn) {
-      CHECK_TRAP_IN_HELPER(meta->jit_fn());
-    } else {
-      auto result = call_interp();
-      if (result != wabt::interp::Result::Returned)
-        return static_cast<Result_t>(result);
-    }
+  wabt::interp::Environment::JITedFunction jit_fn;
+  if (th->env_->TryJit(offset, &jit_fn)) {
+    TRAP_IF(!jit_fn, FailedJITCompilation);
+    CHECK_TRAP_IN_HELPER(th->CallJITed(jit_fn));
   } else {
     auto result = call_interp();
     if (result != wabt::interp::Result::Returned)
@@ -140,52 +147,156 @@ FunctionBuilder::Result_t FunctionBuilder::CallHelper(wabt::interp::Thread* th,
   return static_cast<Result_t>(wabt::interp::Result::Ok);
 }
 
-FunctionBuilder::Result_t FunctionBuilder::CallIndirectHelper(wabt::interp::Thread* th, Index table_index, Index sig_index, Index entry_index, uint8_t* current_pc) {
+FunctionBuilder::Result_t FunctionBuilder::CallIndirectHelper(wabt::interp::Thread* th, Index table_index, Index canonical_sig_index, Index entry_index, uint8_t* current_pc,
+                                                              interp::Environment::CallIndirectCache* cache) {
   using namespace wabt::interp;
   auto* env = th->env_;
   Table* table = &env->tables_[table_index];
   TRAP_IF(entry_index >= table->func_indexes.size(), UndefinedTableIndex);
   Index func_index = table->func_indexes[entry_index];
   TRAP_IF(func_index == kInvalidIndex, UninitializedTableElement);
-  Func* func = env->funcs_[func_index].get();
-  TRAP_UNLESS(env->FuncSignaturesAreEqual(func->sig_index, sig_index),
+  TRAP_UNLESS(table->canonical_sig_indexes[entry_index] == canonical_sig_index,
               IndirectCallSignatureMismatch);
+  Func* func = env->funcs_[func_index].get();
   if (func->is_host) {
     auto result = static_cast<Result_t>(th->CallHost(cast<HostFunc>(func)));
     if (result != static_cast<Result_t>(interp::Result::Ok))
       return result;
   } else {
-    auto result = CallHelper(th, cast<DefinedFunc>(func)->offset, current_pc);
+    auto offset = cast<DefinedFunc>(func)->offset;
+    auto result = CallHelper(th, offset, current_pc);
     if (result != static_cast<Result_t>(interp::Result::Ok))
       return result;
+
+    // The callee may only have been compiled by this call. Callees without
+    // JIT metadata are not cached, so they keep being called through here.
+    auto meta_it = env->jit_meta_.find(offset);
+    if (meta_it != env->jit_meta_.end()) {
+      auto* meta = &meta_it->second;
+      if (meta->compiled && meta->jit_fn.load()) {
+        AddToCallIndirectCache(cache, entry_index, &meta->jit_fn);
+      }
+    }
   }
   return static_cast<Result_t>(interp::Result::Ok);
 }
 
+/**
+ * Fills the first free slot of the cache, unless the entry is cached already.
+ * Once all slots are taken, the call site is considered megamorphic and keeps
+ * going through CallIndirectHelper for the other entries.
+ */
+void FunctionBuilder::AddToCallIndirectCache(interp::Environment::CallIndirectCache* cache, Index entry_index,
+                                             std::atomic<interp::Environment::JITedFunction>* jit_fn) {
+  // Several threads may miss the cache at once, but each slot must only be
+  // written once
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto& slot : cache->slots) {
+    Index slot_entry = slot.entry_index.load(std::memory_order_relaxed);
+    if (slot_entry == entry_index) {
+      return;
+    }
+
+    if (slot_entry == kInvalidIndex) {
+      slot.jit_fn.store(jit_fn, std::memory_order_relaxed);
+      slot.entry_index.store(entry_index, std::memory_order_release);
+      return;
+    }
+  }
+}
+
 FunctionBuilder::Result_t FunctionBuilder::CallHostHelper(wabt::interp::Thread* th, Index func_index) {
   return static_cast<Result_t>(th->CallHost(cast<wabt::interp::HostFunc>(th->env_->funcs_[func_index].get())));
 }
 
-void* FunctionBuilder::MemoryTranslationHelper(interp::Thread* th, uint32_t memory_id, uint64_t address, uint32_t size) {
+void* FunctionBuilder::MemoryBaseHelper(interp::Thread* th, uint32_t memory_id) {
+  return th->env_->memories_[memory_id].data.data();
+}
+
+uint64_t FunctionBuilder::MemorySizeHelper(interp::Thread* th, uint32_t memory_id) {
+  return th->env_->memories_[memory_id].data.size();
+}
+
+uint32_t FunctionBuilder::CurrentMemoryHelper(interp::Thread* th, uint32_t memory_id) {
+  return th->env_->memories_[memory_id].page_limits.initial;
+}
+
+uint32_t FunctionBuilder::GrowMemoryHelper(interp::Thread* th, uint32_t memory_id, uint32_t grow_pages) {
   auto* memory = &th->env_->memories_[memory_id];
+  uint32_t old_page_size = memory->page_limits.initial;
+  uint32_t new_page_size = old_page_size + grow_pages;
+  uint32_t max_page_size = memory->page_limits.has_max
+                               ? memory->page_limits.max
+                               : WABT_MAX_PAGES;
+  if (new_page_size > max_page_size ||
+      static_cast<uint64_t>(new_page_size) * WABT_PAGE_SIZE > UINT32_MAX ||
+      !memory->data.resize(new_page_size * WABT_PAGE_SIZE)) {
+    return static_cast<uint32_t>(-1);
+  }
 
-  if (address + size > memory->data.size()) {
-    return nullptr;
-  } else {
-    return memory->data.data() + address;
+  memory->page_limits.initial = new_page_size;
+  return old_page_size;
+}
+
+void FunctionBuilder::TierUpHelper(interp::Environment* env, interp::Environment::JitMeta* meta) {
+  env->TierUp(meta);
+}
+
+template <typename MemType, FunctionBuilder::AtomicRmwOp op>
+uint64_t FunctionBuilder::AtomicRmwHelper(void* address, uint64_t value) {
+  using U = typename std::make_unsigned<MemType>::type;
+  auto* p = static_cast<U*>(address);
+  auto v = static_cast<U>(value);
+
+  switch (op) {
+    case AtomicRmwOp::Add: return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+    case AtomicRmwOp::Sub: return __atomic_fetch_sub(p, v, __ATOMIC_SEQ_CST);
+    case AtomicRmwOp::And: return __atomic_fetch_and(p, v, __ATOMIC_SEQ_CST);
+    case AtomicRmwOp::Or: return __atomic_fetch_or(p, v, __ATOMIC_SEQ_CST);
+    case AtomicRmwOp::Xor: return __atomic_fetch_xor(p, v, __ATOMIC_SEQ_CST);
+    case AtomicRmwOp::Xchg: return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
   }
+  WABT_UNREACHABLE;
 }
 
-FunctionBuilder::FunctionBuilder(interp::Thread* thread, interp::DefinedFunc* fn, TypeDictionary* types)
+template <typename MemType>
+uint64_t FunctionBuilder::AtomicCmpxchgHelper(void* address, uint64_t expected, uint64_t replacement) {
+  using U = typename std::make_unsigned<MemType>::type;
+  auto read = static_cast<U>(expected);
+  // On failure, read is updated to the value found in memory
+  __atomic_compare_exchange_n(static_cast<U*>(address), &read, static_cast<U>(replacement),
+                              false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return read;
+}
+
+template <typename MemType>
+void FunctionBuilder::AtomicStoreHelper(void* address, uint64_t value) {
+  using U = typename std::make_unsigned<MemType>::type;
+  __atomic_store_n(static_cast<U*>(address), static_cast<U>(value), __ATOMIC_SEQ_CST);
+}
+
+FunctionBuilder::FunctionBuilder(interp::Environment* env,
+                                 interp::DefinedFunc* fn,
+                                 TypeDictionary* types,
+                                 interp::IstreamOffset osr_offset,
+                                 unsigned tier)
     : TR::MethodBuilder(types),
-      thread_(thread),
+      env_(env),
       fn_(fn),
+      osr_offset_(osr_offset),
+      tier_(tier),
+      name_(fn->dbg_name_ + (tier > 1 ? JIT_TIER2_NAME_SUFFIX : "")),
       valueType_(types->LookupUnion("Value")),
       pValueType_(types->PointerTo(types->LookupUnion("Value"))) {
   DefineLine(__LINE__);
   DefineFile(__FILE__);
-  DefineName(fn->dbg_name_.c_str());
+  DefineName(name_.c_str());
 
+  // JITed code must not depend on the thread it was compiled for, so that all
+  // threads of the environment can run it. The thread is an argument instead.
+  DefineParameter("thread", types->PointerTo("Thread"));
   DefineReturnType(types->toIlType<Result_t>());
 
   DefineFunction("f32_sqrt", __FILE__, "0",
@@ -193,6 +304,29 @@ FunctionBuilder::FunctionBuilder(interp::Thread* thread, interp::DefinedFunc* fn
                  Float,
                  1,
                  Float);
+  // JitBuilder has no rounding services, so ceil, floor, trunc and nearest are
+  // deliberately out-of-line calls into libm rather than roundss/roundsd. This
+  // fallback also covers the f64 versions below.
+  DefineFunction("f32_ceil", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<float (*)(float)>(std::ceil)),
+                 Float,
+                 1,
+                 Float);
+  DefineFunction("f32_floor", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<float (*)(float)>(std::floor)),
+                 Float,
+                 1,
+                 Float);
+  DefineFunction("f32_trunc", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<float (*)(float)>(std::trunc)),
+                 Float,
+                 1,
+                 Float);
+  DefineFunction("f32_nearest", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<float (*)(float)>(std::nearbyint)),
+                 Float,
+                 1,
+                 Float);
   DefineFunction("f32_copysign", __FILE__, "0",
                  reinterpret_cast<void*>(static_cast<float (*)(float, float)>(std::copysign)),
                  Float,
@@ -204,12 +338,38 @@ FunctionBuilder::FunctionBuilder(interp::Thread* thread, interp::DefinedFunc* fn
                  Double,
                  1,
                  Double);
+  DefineFunction("f64_ceil", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<double (*)(double)>(std::ceil)),
+                 Double,
+                 1,
+                 Double);
+  DefineFunction("f64_floor", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<double (*)(double)>(std::floor)),
+                 Double,
+                 1,
+                 Double);
+  DefineFunction("f64_trunc", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<double (*)(double)>(std::trunc)),
+                 Double,
+                 1,
+                 Double);
+  DefineFunction("f64_nearest", __FILE__, "0",
+                 reinterpret_cast<void*>(static_cast<double (*)(double)>(std::nearbyint)),
+                 Double,
+                 1,
+                 Double);
   DefineFunction("f64_copysign", __FILE__, "0",
                  reinterpret_cast<void*>(static_cast<double (*)(double, double)>(std::copysign)),
                  Double,
                  2,
                  Double,
                  Double);
+  // Signature of JITed functions, used to call them through ComputedCall
+  DefineFunction("JITedFunction", __FILE__, "0",
+                 nullptr,
+                 types->toIlType<Result_t>(),
+                 1,
+                 types->PointerTo("Thread"));
   DefineFunction("CallHelper", __FILE__, "0",
                  reinterpret_cast<void*>(CallHelper),
                  types->toIlType<Result_t>(),
@@ -220,32 +380,139 @@ FunctionBuilder::FunctionBuilder(interp::Thread* thread, interp::DefinedFunc* fn
   DefineFunction("CallIndirectHelper", __FILE__, "0",
                  reinterpret_cast<void*>(CallIndirectHelper),
                  types->toIlType<Result_t>(),
-                 5,
+                 6,
                  types->toIlType<void*>(),
                  types->toIlType<Index>(),
                  types->toIlType<Index>(),
                  types->toIlType<Index>(),
-                 types->PointerTo(Int8));
+                 types->PointerTo(Int8),
+                 types->toIlType<void*>());
   DefineFunction("CallHostHelper", __FILE__, "0",
                  reinterpret_cast<void*>(CallHostHelper),
                  types->toIlType<Result_t>(),
                  2,
                  types->toIlType<void*>(),
                  types->toIlType<Index>());
-  DefineFunction("MemoryTranslationHelper", __FILE__, "0",
-                 reinterpret_cast<void*>(MemoryTranslationHelper),
+  DefineFunction("MemoryBaseHelper", __FILE__, "0",
+                 reinterpret_cast<void*>(MemoryBaseHelper),
                  types->toIlType<void*>(),
-                 4,
+                 2,
                  types->toIlType<void*>(),
-                 types->toIlType<uint32_t>(),
+                 types->toIlType<uint32_t>());
+  DefineFunction("MemorySizeHelper", __FILE__, "0",
+                 reinterpret_cast<void*>(MemorySizeHelper),
                  types->toIlType<uint64_t>(),
+                 2,
+                 types->toIlType<void*>(),
+                 types->toIlType<uint32_t>());
+  DefineFunction("CurrentMemoryHelper", __FILE__, "0",
+                 reinterpret_cast<void*>(CurrentMemoryHelper),
+                 types->toIlType<uint32_t>(),
+                 2,
+                 types->toIlType<void*>(),
+                 types->toIlType<uint32_t>());
+  DefineFunction("GrowMemoryHelper", __FILE__, "0",
+                 reinterpret_cast<void*>(GrowMemoryHelper),
+                 types->toIlType<uint32_t>(),
+                 3,
+                 types->toIlType<void*>(),
+                 types->toIlType<uint32_t>(),
                  types->toIlType<uint32_t>());
+  DefineFunction("TierUpHelper", __FILE__, "0",
+                 reinterpret_cast<void*>(TierUpHelper),
+                 NoType,
+                 2,
+                 types->toIlType<void*>(),
+                 types->toIlType<void*>());
+
+#define ATOMIC_HELPERS(helper, ...)                          \
+  {reinterpret_cast<void*>(helper<int8_t, ##__VA_ARGS__>),   \
+   reinterpret_cast<void*>(helper<int16_t, ##__VA_ARGS__>),  \
+   reinterpret_cast<void*>(helper<int32_t, ##__VA_ARGS__>),  \
+   reinterpret_cast<void*>(helper<int64_t, ##__VA_ARGS__>)}
+
+  void* const atomic_rmw_helpers[][4] = {
+    ATOMIC_HELPERS(AtomicRmwHelper, AtomicRmwOp::Add),
+    ATOMIC_HELPERS(AtomicRmwHelper, AtomicRmwOp::Sub),
+    ATOMIC_HELPERS(AtomicRmwHelper, AtomicRmwOp::And),
+    ATOMIC_HELPERS(AtomicRmwHelper, AtomicRmwOp::Or),
+    ATOMIC_HELPERS(AtomicRmwHelper, AtomicRmwOp::Xor),
+    ATOMIC_HELPERS(AtomicRmwHelper, AtomicRmwOp::Xchg),
+  };
+  void* const atomic_cmpxchg_helpers[] = ATOMIC_HELPERS(AtomicCmpxchgHelper);
+  void* const atomic_store_helpers[] = ATOMIC_HELPERS(AtomicStoreHelper);
+
+#undef ATOMIC_HELPERS
+
+  for (int i = 0; i < 4; ++i) {
+    for (int op = 0; op < 6; ++op) {
+      DefineFunction(kAtomicRmwHelperNames[op][i], __FILE__, "0",
+                     atomic_rmw_helpers[op][i],
+                     Int64,
+                     2,
+                     Address,
+                     Int64);
+    }
+    DefineFunction(kAtomicCmpxchgHelperNames[i], __FILE__, "0",
+                   atomic_cmpxchg_helpers[i],
+                   Int64,
+                   3,
+                   Address,
+                   Int64,
+                   Int64);
+    DefineFunction(kAtomicStoreHelperNames[i], __FILE__, "0",
+                   atomic_store_helpers[i],
+                   NoType,
+                   2,
+                   Address,
+                   Int64);
+  }
+
+  // Params and locals are kept in JitBuilder locals for the whole function, so
+  // the optimizer is free to keep them in registers.
+  local_names_.reserve(fn->param_and_local_types.size());
+  for (Index i = 0; i < fn->param_and_local_types.size(); ++i) {
+    local_names_.push_back("local_" + std::to_string(i));
+    DefineLocal(local_names_[i].c_str(), IlTypeOf(fn->param_and_local_types[i]));
+  }
 }
 
 bool FunctionBuilder::buildIL() {
-  setVMState(new TR::VirtualMachineState());
+  Store("value_stack",
+        LoadIndirect("Thread", "value_stack_data_", Load("thread")));
+
+  // The memory caches used by the function are only known once all of it has
+  // been emitted, so their initialization is generated last.
+  auto* init_memory_caches = OrphanBuilder();
+  AppendBuilder(init_memory_caches);
+  memory_cache_resets_.push_back(init_memory_caches);
+
+  // Likewise, the state at the loop header is only known once it has been
+  // emitted. The normal entry below is still emitted to compute it, but is
+  // never executed.
+  TR::IlBuilder* osr_entry = nullptr;
+  if (osr_offset_ != interp::kInvalidIstreamOffset) {
+    osr_entry = OrphanBuilder();
+    AppendBuilder(osr_entry);
+  }
+
+  Store("frame_base",
+        LoadIndirect("Thread", "value_stack_top_", Load("thread")));
 
-  const uint8_t* istream = thread_->GetIstream();
+  auto num_params = static_cast<int32_t>(fn_->param_and_local_types.size() - fn_->local_count);
+  for (int32_t i = 0; i < num_params; ++i) {
+    const char* type = TypeFieldName(fn_->param_and_local_types[i]);
+    Store(local_names_[i].c_str(),
+          LoadIndirect("Value", type, StackSlotAddress(this, i - num_params)));
+  }
+
+  if (CountsHotness()) {
+    EmitHotnessCount(this);
+  }
+
+  setVMState(new OperandStack());
+
+  const uint8_t* istream = GetIstream();
 
   workItems_.emplace_back(OrphanBytecodeBuilder(0, const_cast<char*>(ReadOpcodeAt(&istream[fn_->offset]).GetName())),
                           &istream[fn_->offset]);
@@ -255,130 +522,81 @@ bool FunctionBuilder::buildIL() {
 
   while ((next_index = GetNextBytecodeFromWorklist()) != -1) {
     auto& work_item = workItems_[next_index];
+    inline_frame_ = work_item.frame;
 
-    if (!Emit(work_item.builder, istream, work_item.pc))
+    if (work_item.is_table_entry) {
+      EmitBrTableEntry(work_item.builder, istream, work_item.pc);
+    } else if (!Emit(work_item.builder, istream, work_item.pc)) {
       return false;
+    }
+  }
+
+  inline_frame_ = nullptr;
+  if (osr_entry != nullptr && !EmitOsrEntry(osr_entry, &istream[osr_offset_])) {
+    return false;
+  }
+
+  for (auto* b : memory_cache_resets_) {
+    for (const auto& cache : memory_caches_) {
+      b->Store(cache.second.base.c_str(), b->ConstAddress(nullptr));
+      b->Store(cache.second.size.c_str(), b->ConstInt64(0));
+    }
   }
 
   return true;
 }
 
-/**
- * @brief Generate push to the interpreter stack
- *
- * The generated code should be equivalent to:
- *
- * auto stack_top = *stack_top_addr;
- * stack_base_addr[stack_top] = value;
- * *stack_top_addr = stack_top + 1;
- */
-void FunctionBuilder::Push(TR::IlBuilder* b, const char* type, TR::IlValue* value, const uint8_t* pc) {
-  auto pInt32 = typeDictionary()->PointerTo(Int32);
-  auto* stack_top_addr = b->ConstAddress(&thread_->value_stack_top_);
-  auto* stack_base_addr = b->ConstAddress(thread_->value_stack_.data());
-
-  auto* stack_top = b->LoadAt(pInt32, stack_top_addr);
+void FunctionBuilder::Push(TR::BytecodeBuilder* b, const char* type, TR::IlValue* value) {
+  Stack(b)->Push(type, value);
+}
 
-  EmitTrapIf(b,
-  b->        UnsignedGreaterOrEqualTo(
-                 stack_top,
-  b->            Const(static_cast<int32_t>(thread_->value_stack_.size()))),
-  b->        Const(static_cast<Result_t>(interp::Result::TrapValueStackExhausted)),
-             pc);
+TR::IlValue* FunctionBuilder::Pop(TR::BytecodeBuilder* b, const char* type) {
+  auto entry = Stack(b)->Pop();
+  TR_ASSERT(strcmp(entry.type, type) == 0, "Popped value has an unexpected type");
+  return entry.value;
+}
 
-  b->StoreIndirect("Value", type,
-  b->              IndexAt(pValueType_,
-                           stack_base_addr,
-                           stack_top),
-                   value);
-  b->StoreAt(stack_top_addr,
-  b->        Add(
-                 stack_top,
-  b->            Const(1)));
+void FunctionBuilder::DropKeep(TR::BytecodeBuilder* b, uint32_t drop_count, uint8_t keep_count) {
+  Stack(b)->DropKeep(drop_count, keep_count);
 }
 
-/**
- * @brief Generate pop from the interpreter stack
- *
- * The generated code should be equivalent to:
- *
- * auto new_stack_top = *stack_top_addr - 1;
- * *stack_top_addr = new_stack_top;
- * return stack_base_addr[new_stack_top];
- */
-TR::IlValue* FunctionBuilder::Pop(TR::IlBuilder* b, const char* type) {
-  auto pInt32 = typeDictionary()->PointerTo(Int32);
-  auto* stack_top_addr = b->ConstAddress(&thread_->value_stack_top_);
-  auto* stack_base_addr = b->ConstAddress(thread_->value_stack_.data());
+OperandStack::Entry FunctionBuilder::Pick(TR::BytecodeBuilder* b, Index depth) {
+  auto* stack = Stack(b);
+
+  if (auto* entry = stack->Pick(depth)) {
+    return *entry;
+  }
 
-  auto* new_stack_top = b->Sub(
-                        b->    LoadAt(pInt32, stack_top_addr),
-                        b->    Const(1));
-  b->StoreAt(stack_top_addr, new_stack_top);
-  return b->LoadIndirect("Value", type,
-         b->             IndexAt(pValueType_,
-                                 stack_base_addr,
-                                 new_stack_top));
+  Index local_index = LocalIndex(stack->Height() - static_cast<int32_t>(depth));
+  return OperandStack::Entry(TypeFieldName(fn_->param_and_local_types[local_index]),
+                             b->Load(local_names_[local_index].c_str()));
 }
 
-/**
- * @brief Generate a drop-x from the interpreter stack, optionally keeping the top value
- *
- * The generated code should be equivalent to:
- *
- * auto stack_top = *stack_top_addr;
- * auto new_stack_top = stack_top - drop_count;
- *
- * if (keep_count == 1) {
- *   stack_base_addr[new_stack_top - 1] = stack_base_addr[stack_top - 1];
- * }
- *
- * *stack_top_addr = new_stack_top;
- */
-void FunctionBuilder::DropKeep(TR::IlBuilder* b, uint32_t drop_count, uint8_t keep_count) {
-  TR_ASSERT(keep_count <= 1, "Invalid keep count");
-
-  auto pInt32 = typeDictionary()->PointerTo(Int32);
-  auto* stack_top_addr = b->ConstAddress(&thread_->value_stack_top_);
-  auto* stack_base_addr = b->ConstAddress(thread_->value_stack_.data());
-
-  auto* stack_top = b->LoadAt(pInt32, stack_top_addr);
-  auto* new_stack_top = b->Sub(stack_top, b->Const(static_cast<int32_t>(drop_count)));
-
-  if (keep_count == 1) {
-    auto* old_top_value = b->LoadAt(pValueType_,
-                          b->       IndexAt(pValueType_,
-                                            stack_base_addr,
-                          b->               Sub(stack_top, b->Const(1))));
-
-    b->StoreAt(
-    b->        IndexAt(pValueType_,
-                       stack_base_addr,
-    b->                Sub(new_stack_top, b->Const(1))),
-               old_top_value);
+void FunctionBuilder::Poke(TR::BytecodeBuilder* b, Index depth, TR::IlValue* value) {
+  auto* stack = Stack(b);
+
+  if (auto* entry = stack->Pick(depth)) {
+    entry->value = value;
+    return;
   }
 
-  b->StoreAt(stack_top_addr, new_stack_top);
+  Index local_index = LocalIndex(stack->Height() - static_cast<int32_t>(depth));
+  b->Store(local_names_[local_index].c_str(), value);
 }
 
 /**
- * @brief Generate load from the interpreter stack by an index
- *
- * The generate code should be equivalent to:
- *
- * return &value_stack_[value_stack_top_ - depth];
+ * The params and locals of an inlined call are tracked on the operand stack,
+ * above its frame base. Those of the function itself are below the bottom of
+ * the operand stack.
  */
-TR::IlValue* FunctionBuilder::Pick(TR::IlBuilder* b, Index depth) {
-  auto pInt32 = typeDictionary()->PointerTo(Int32);
-  auto* stack_top_addr = b->ConstAddress(&thread_->value_stack_top_);
-  auto* stack_base_addr = b->ConstAddress(thread_->value_stack_.data());
-
-  auto* offset = b->Sub(
-                 b->    LoadAt(pInt32, stack_top_addr),
-                 b->    ConstInt32(depth));
-  return b->IndexAt(pValueType_,
-                    stack_base_addr,
-                    offset);
+OperandStack::Entry FunctionBuilder::PickLocal(TR::BytecodeBuilder* b, Index offset) {
+  int32_t position = (inline_frame_ != nullptr ? inline_frame_->frame_base : 0) + static_cast<int32_t>(offset);
+  return Pick(b, static_cast<Index>(Stack(b)->Height() - position));
+}
+
+void FunctionBuilder::PokeLocal(TR::BytecodeBuilder* b, Index offset, TR::IlValue* value) {
+  int32_t position = (inline_frame_ != nullptr ? inline_frame_->frame_base : 0) + static_cast<int32_t>(offset);
+  Poke(b, static_cast<Index>(Stack(b)->Height() - position), value);
 }
 
 template <>
@@ -411,6 +629,22 @@ const char* FunctionBuilder::TypeFieldName<double>() const {
   return "f64";
 }
 
+TR::IlType* FunctionBuilder::IlTypeOf(Type t) const {
+  switch (t) {
+    case Type::I32:
+      return Int32;
+    case Type::I64:
+      return Int64;
+    case Type::F32:
+      return Float;
+    case Type::F64:
+      return Double;
+    default:
+      TR_ASSERT_FATAL(false, "Invalid primitive type");
+      return nullptr;
+  }
+}
+
 const char* FunctionBuilder::TypeFieldName(Type t) const {
   switch (t) {
     case Type::I32:
@@ -443,21 +677,90 @@ TR::IlValue* FunctionBuilder::Const(TR::IlBuilder* b, const interp::TypedValue*
   }
 }
 
+OperandStack* FunctionBuilder::Stack(TR::BytecodeBuilder* b) const {
+  return static_cast<OperandStack*>(b->vmState());
+}
+
+TR::IlValue* FunctionBuilder::StackSlotAddress(TR::IlBuilder* b, int32_t position) {
+  return b->IndexAt(pValueType_,
+         b->       Load("value_stack"),
+         b->       Add(
+         b->           Load("frame_base"),
+         b->           ConstInt32(position)));
+}
+
+/**
+ * @brief Get the index of the param or local held by a slot that is not tracked on the operand stack
+ *
+ * Params are located just below the frame base and locals just above it.
+ */
+Index FunctionBuilder::LocalIndex(int32_t position) const {
+  auto num_params = static_cast<int32_t>(fn_->param_and_local_types.size() - fn_->local_count);
+  TR_ASSERT(position >= -num_params && position < static_cast<int32_t>(fn_->local_count),
+            "Accessing a stack slot that is not a param or local");
+  return static_cast<Index>(num_params + position);
+}
+
+/**
+ * @brief Generate code writing the top values of the operand stack to the interpreter stack
+ *
+ * Also updates `Thread::value_stack_top_` to match the current height of the
+ * operand stack, so that code outside of the JITed function (e.g. a callee)
+ * sees a consistent interpreter stack.
+ */
+void FunctionBuilder::SpillStack(TR::BytecodeBuilder* b, Index count, const uint8_t* pc) {
+  auto* stack = Stack(b);
+  TR_ASSERT(count <= stack->Size(), "Spilling values that are not tracked on the operand stack");
+
+  auto* stack_top = b->Add(b->Load("frame_base"), b->ConstInt32(stack->Height()));
+
+  EmitTrapIf(b,
+  b->        UnsignedGreaterThan(
+                 stack_top,
+  b->            LoadIndirect("Thread", "value_stack_size_", b->Load("thread"))),
+  b->        Const(static_cast<Result_t>(interp::Result::TrapValueStackExhausted)),
+             pc);
+
+  for (Index depth = count; depth > 0; --depth) {
+    auto* entry = stack->Pick(depth);
+    b->StoreIndirect("Value", entry->type,
+                     StackSlotAddress(b, stack->Height() - static_cast<int32_t>(depth)),
+                     entry->value);
+  }
+
+  b->StoreIndirect("Thread", "value_stack_top_", b->Load("thread"), stack_top);
+}
+
+/**
+ * @brief Generate loads of the results of a call from the interpreter stack
+ *
+ * Must be called after the arguments of the call have been dropped from the
+ * operand stack, so the results start at the current height.
+ */
+void FunctionBuilder::ReloadResults(TR::BytecodeBuilder* b, const interp::FuncSignature* sig) {
+  auto* stack = Stack(b);
+
+  for (Type type : sig->result_types) {
+    const char* type_field = TypeFieldName(type);
+    Push(b, type_field, b->LoadIndirect("Value", type_field, StackSlotAddress(b, stack->Height())));
+  }
+}
+
 template <typename T, typename TResult, typename TOpHandler>
-void FunctionBuilder::EmitBinaryOp(TR::IlBuilder* b, const uint8_t* pc, TOpHandler h) {
+void FunctionBuilder::EmitBinaryOp(TR::BytecodeBuilder* b, const uint8_t* pc, TOpHandler h) {
   auto* rhs = Pop(b, TypeFieldName<T>());
   auto* lhs = Pop(b, TypeFieldName<T>());
 
-  Push(b, TypeFieldName<TResult>(), h(lhs, rhs), pc);
+  Push(b, TypeFieldName<TResult>(), h(lhs, rhs));
 }
 
 template <typename T, typename TResult, typename TOpHandler>
-void FunctionBuilder::EmitUnaryOp(TR::IlBuilder* b, const uint8_t* pc, TOpHandler h) {
-  Push(b, TypeFieldName<TResult>(), h(Pop(b, TypeFieldName<T>())), pc);
+void FunctionBuilder::EmitUnaryOp(TR::BytecodeBuilder* b, const uint8_t* pc, TOpHandler h) {
+  Push(b, TypeFieldName<TResult>(), h(Pop(b, TypeFieldName<T>())));
 }
 
 template <typename T>
-void FunctionBuilder::EmitIntDivide(TR::IlBuilder* b, const uint8_t* pc) {
+void FunctionBuilder::EmitIntDivide(TR::BytecodeBuilder* b, const uint8_t* pc) {
   static_assert(std::is_integral<T>::value,
                 "EmitIntDivide only works on integral types");
 
@@ -479,7 +782,7 @@ void FunctionBuilder::EmitIntDivide(TR::IlBuilder* b, const uint8_t* pc) {
 }
 
 template <typename T>
-void FunctionBuilder::EmitIntRemainder(TR::IlBuilder* b, const uint8_t* pc) {
+void FunctionBuilder::EmitIntRemainder(TR::BytecodeBuilder* b, const uint8_t* pc) {
   static_assert(std::is_integral<T>::value,
                 "EmitIntRemainder only works on integral types");
 
@@ -503,31 +806,432 @@ void FunctionBuilder::EmitIntRemainder(TR::IlBuilder* b, const uint8_t* pc) {
   });
 }
 
+/**
+ * @brief Generate an unsigned integer division
+ *
+ * T is the signed type of the operands (as for the other unsigned operations),
+ * only the division treats them as unsigned.
+ */
+template <typename T>
+void FunctionBuilder::EmitUnsignedIntDivide(TR::BytecodeBuilder* b, const uint8_t* pc) {
+  static_assert(std::is_integral<T>::value,
+                "EmitUnsignedIntDivide only works on integral types");
+
+  EmitBinaryOp<T>(b, pc, [&](TR::IlValue* dividend, TR::IlValue* divisor) {
+    EmitTrapIf(b,
+    b->        EqualTo(divisor, b->Const(static_cast<T>(0))),
+    b->        Const(static_cast<Result_t>(interp::Result::TrapIntegerDivideByZero)),
+               pc);
+
+    return b->UnsignedDiv(dividend, divisor);
+  });
+}
+
+template <typename T>
+void FunctionBuilder::EmitUnsignedIntRemainder(TR::BytecodeBuilder* b, const uint8_t* pc) {
+  static_assert(std::is_integral<T>::value,
+                "EmitUnsignedIntRemainder only works on integral types");
+
+  EmitBinaryOp<T>(b, pc, [&](TR::IlValue* dividend, TR::IlValue* divisor) {
+    EmitTrapIf(b,
+    b->        EqualTo(divisor, b->Const(static_cast<T>(0))),
+    b->        Const(static_cast<Result_t>(interp::Result::TrapIntegerDivideByZero)),
+               pc);
+
+    return b->UnsignedRem(dividend, divisor);
+  });
+}
+
+/**
+ * @brief Get the names of the locals caching the base and size of a memory
+ *
+ * The cache is invalid while the size is 0. Since every access is at least one
+ * byte large, an invalid cache always fails the bounds check and is reloaded.
+ */
+const FunctionBuilder::MemoryCache& FunctionBuilder::GetMemoryCache(Index memory_id) {
+  auto it = memory_caches_.find(memory_id);
+
+  if (it == memory_caches_.end()) {
+    MemoryCache cache;
+    cache.base = "memory_base_" + std::to_string(memory_id);
+    cache.size = "memory_size_" + std::to_string(memory_id);
+    it = memory_caches_.emplace(memory_id, std::move(cache)).first;
+
+    DefineLocal(it->second.base.c_str(), Address);
+    DefineLocal(it->second.size.c_str(), Int64);
+  }
+
+  return it->second;
+}
+
+/**
+ * @brief Generate code invalidating the memory caches
+ *
+ * Must be used whenever a memory may have been grown (e.g. by a callee).
+ */
+void FunctionBuilder::EmitMemoryCacheReset(TR::IlBuilder* b) {
+  auto* reset = OrphanBuilder();
+  b->AppendBuilder(reset);
+  memory_cache_resets_.push_back(reset);
+}
+
+/**
+ * @brief Generate the bounds check of a memory access
+ *
+ * For memories that are not guarded, the generated code should be equivalent to:
+ *
+ * auto address = (uint64_t)index + offset;
+ * if (address + sizeof(T) > memory_size) {
+ *   memory_base = MemoryBaseHelper(thread, memory_id);
+ *   memory_size = MemorySizeHelper(thread, memory_id);
+ *   TRAP_IF(address + sizeof(T) > memory_size, MemoryAccessOutOfBounds);
+ * }
+ * return memory_base + address;
+ *
+ * Atomic accesses are always checked explicitly, like in the interpreter, and
+ * additionally trap with AtomicMemoryAccessUnaligned if the address is not a
+ * multiple of sizeof(T).
+ */
 template <typename T>
-TR::IlValue* FunctionBuilder::EmitMemoryPreAccess(TR::IlBuilder* b, const uint8_t** pc) {
-  auto th_addr = b->ConstAddress(thread_);
-  auto mem_id = b->ConstInt32(ReadU32(pc));
+TR::IlValue* FunctionBuilder::EmitMemoryPreAccess(TR::BytecodeBuilder* b, const uint8_t** pc, bool atomic) {
+  Index memory_id = ReadU32(pc);
   auto offset = b->ConstInt64(static_cast<uint64_t>(ReadU32(pc)));
+  auto* address = b->Add(b->UnsignedConvertTo(Int64, Pop(b, "i32")), offset);
+
+  // Faults are reported with the call stack as it is, which lacks the frames
+  // of inlined callees, so accesses in inlined code are checked explicitly.
+  auto* memory = &env_->memories_[memory_id];
+  if (memory->data.guarded() && !atomic && inline_frame_ == nullptr) {
+    // The address of a guarded memory never changes and out-of-bounds accesses
+    // fault, so only the pc needs to be recorded for the trap to be reported.
+    b->StoreIndirect("Thread", "pc_", b->Load("thread"),
+                     b->ConstInt32(*pc - GetIstream()));
+    return b->IndexAt(typeDictionary()->PointerTo(Int8), b->ConstAddress(memory->data.data()), address);
+  }
 
-  auto address = b->Call("MemoryTranslationHelper",
-                         4,
-                         th_addr,
-                         mem_id,
-                         b->Add(b->UnsignedConvertTo(Int64, Pop(b, "i32")), offset),
-                         b->ConstInt32(sizeof(T)));
+  const auto& cache = GetMemoryCache(memory_id);
+  auto* access_end = b->Add(address, b->ConstInt64(sizeof(T)));
 
-  EmitTrapIf(b,
-  b->        EqualTo(address, b->ConstAddress(nullptr)),
-  b->        Const(static_cast<Result_t>(interp::Result::TrapMemoryAccessOutOfBounds)),
+  TR::IlBuilder* reload = nullptr;
+  b->IfThen(&reload,
+  b->       UnsignedGreaterThan(access_end, b->Load(cache.size.c_str())));
+
+  reload->Store(cache.base.c_str(),
+  reload->      Call("MemoryBaseHelper", 2, reload->Load("thread"), reload->ConstInt32(memory_id)));
+  reload->Store(cache.size.c_str(),
+  reload->      Call("MemorySizeHelper", 2, reload->Load("thread"), reload->ConstInt32(memory_id)));
+
+  EmitTrapIf(reload,
+  reload->   UnsignedGreaterThan(access_end, reload->Load(cache.size.c_str())),
+  reload->   Const(static_cast<Result_t>(interp::Result::TrapMemoryAccessOutOfBounds)),
              *pc);
 
-  return address;
+  if (atomic && sizeof(T) > 1) {
+    EmitTrapIf(b,
+    b->        NotEqualTo(
+    b->                   And(address, b->ConstInt64(sizeof(T) - 1)),
+    b->                   ConstInt64(0)),
+    b->        Const(static_cast<Result_t>(interp::Result::TrapAtomicMemoryAccessUnaligned)),
+               *pc);
+  }
+
+  return b->IndexAt(typeDictionary()->PointerTo(Int8), b->Load(cache.base.c_str()), address);
+}
+
+/**
+ * @brief Generate an atomic load
+ *
+ * Aligned loads are atomic on the supported targets and sequentially consistent
+ * when all atomic stores and read-modify-writes are locked, so they are inlined.
+ */
+template <typename MemType, typename T>
+void FunctionBuilder::EmitAtomicLoad(TR::BytecodeBuilder* b, const uint8_t** pc) {
+  auto* address = EmitMemoryPreAccess<MemType>(b, pc, true);
+  auto* value = b->LoadAt(typeDictionary()->PointerTo(typeDictionary()->toIlType<MemType>()), address);
+
+  if (sizeof(MemType) < sizeof(T)) {
+    value = b->UnsignedConvertTo(typeDictionary()->toIlType<T>(), value);
+  }
+
+  Push(b, TypeFieldName<T>(), value);
 }
 
+template <typename T>
+TR::IlValue* FunctionBuilder::EmitZeroExtendToInt64(TR::IlBuilder* b, TR::IlValue* value) {
+  return sizeof(T) < sizeof(int64_t) ? b->UnsignedConvertTo(Int64, value) : value;
+}
+
+template <typename T>
+TR::IlValue* FunctionBuilder::EmitWrapFromInt64(TR::IlBuilder* b, TR::IlValue* value) {
+  return sizeof(T) < sizeof(int64_t) ? b->ConvertTo(typeDictionary()->toIlType<T>(), value) : value;
+}
+
+template <typename MemType, typename T>
+void FunctionBuilder::EmitAtomicStore(TR::BytecodeBuilder* b, const uint8_t** pc) {
+  auto* value = Pop(b, TypeFieldName<T>());
+  auto* address = EmitMemoryPreAccess<MemType>(b, pc, true);
+
+  b->Call(kAtomicStoreHelperNames[AtomicHelperIndex<MemType>()], 2,
+          address,
+          EmitZeroExtendToInt64<T>(b, value));
+}
+
+/**
+ * @brief Generate an atomic read-modify-write, leaving the value read on the stack
+ *
+ * Full-width additions and subtractions use JitBuilder's AtomicAdd service, all
+ * other operations call a helper.
+ */
+template <typename MemType, typename T>
+void FunctionBuilder::EmitAtomicRmw(TR::BytecodeBuilder* b, const uint8_t** pc, AtomicRmwOp op) {
+  auto* value = Pop(b, TypeFieldName<T>());
+  auto* address = EmitMemoryPreAccess<MemType>(b, pc, true);
+
+  TR::IlValue* read = nullptr;
+  if (sizeof(MemType) == sizeof(T) && (op == AtomicRmwOp::Add || op == AtomicRmwOp::Sub)) {
+    if (op == AtomicRmwOp::Sub) {
+      value = b->Sub(b->Const(static_cast<T>(0)), value);
+    }
+    read = b->AtomicAdd(address, value);
+  } else {
+    read = EmitWrapFromInt64<T>(b,
+           b->                  Call(kAtomicRmwHelperNames[static_cast<int>(op)][AtomicHelperIndex<MemType>()], 2,
+                                     address,
+                                     EmitZeroExtendToInt64<T>(b, value)));
+  }
+
+  Push(b, TypeFieldName<T>(), read);
+}
+
+template <typename MemType, typename T>
+void FunctionBuilder::EmitAtomicCmpxchg(TR::BytecodeBuilder* b, const uint8_t** pc) {
+  auto* replacement = Pop(b, TypeFieldName<T>());
+  auto* expected = Pop(b, TypeFieldName<T>());
+  auto* address = EmitMemoryPreAccess<MemType>(b, pc, true);
+
+  auto* read = b->Call(kAtomicCmpxchgHelperNames[AtomicHelperIndex<MemType>()], 3,
+                       address,
+                       EmitZeroExtendToInt64<T>(b, expected),
+                       EmitZeroExtendToInt64<T>(b, replacement));
+
+  Push(b, TypeFieldName<T>(), EmitWrapFromInt64<T>(b, read));
+}
+
+/**
+ * Only the tier 1 code of functions entered normally counts its hotness; code
+ * compiled for on-stack replacement only runs once.
+ */
+bool FunctionBuilder::CountsHotness() const {
+  return tier_ == 1 && osr_offset_ == interp::kInvalidIstreamOffset && env_->jit_tier2_threshold != 0;
+}
+
+/**
+ * @brief Generate an increment of the hotness of the function, recompiling it once hot
+ *
+ * The generated code should be equivalent to:
+ *
+ * if (++meta->hotness >= jit_tier2_threshold && !meta->tier_up_requested)
+ *   TierUpHelper(env, meta);
+ *
+ * The counter is not incremented atomically, as losing a few counts when
+ * several threads run the function does not matter. The same increments may
+ * then cross the threshold more than once, so TierUpHelper only recompiles the
+ * function for the first thread to set tier_up_requested.
+ */
+void FunctionBuilder::EmitHotnessCount(TR::IlBuilder* b) {
+  auto* meta = &env_->jit_meta_.find(fn_->offset)->second;
+  auto* hotness_addr = b->ConstAddress(&meta->hotness);
+  auto* hotness = b->Add(
+                  b->    LoadAt(typeDictionary()->PointerTo(Int32), hotness_addr),
+                  b->    ConstInt32(1));
+  b->StoreAt(hotness_addr, hotness);
+
+  static_assert(sizeof(meta->tier_up_requested) == sizeof(bool),
+                "tier_up_requested must be loadable as a bool");
+
+  TR::IlBuilder* hot = nullptr;
+  b->IfThen(&hot,
+  b->       UnsignedGreaterOrEqualTo(hotness, b->ConstInt32(static_cast<int32_t>(env_->jit_tier2_threshold))));
+
+  TR::IlBuilder* tier_up = nullptr;
+  hot->IfThen(&tier_up,
+  hot->       EqualTo(
+  hot->           LoadAt(typeDictionary()->PointerTo(Int8), hot->ConstAddress(&meta->tier_up_requested)),
+  hot->           ConstInt8(0)));
+  tier_up->Call("TierUpHelper", 2, tier_up->ConstAddress(env_), tier_up->ConstAddress(meta));
+}
+
+/**
+ * @brief Generate an inline equivalent of `Thread::PushCall`
+ *
+ * The generated code should be equivalent to:
+ *
+ * TRAP_IF(call_stack_top_ >= call_stack_.size(), CallStackExhausted);
+ * call_stack_[call_stack_top_++] = {pc - istream, frame_base_};
+ * frame_base_ = value_stack_top_;
+ *
+ * Like the interpreter, the matching pop (see EmitPopCall) is only done when the
+ * callee returns successfully.
+ */
+void FunctionBuilder::EmitPushCall(TR::IlBuilder* b, const uint8_t* pc) {
+  auto* thread = b->Load("thread");
+  auto* call_stack_top = b->LoadIndirect("Thread", "call_stack_top_", thread);
+
+  EmitTrapIf(b,
+  b->        UnsignedGreaterOrEqualTo(
+                 call_stack_top,
+  b->            LoadIndirect("Thread", "call_stack_size_", thread)),
+  b->        Const(static_cast<Result_t>(interp::Result::TrapCallStackExhausted)),
+             pc);
+
+  EmitStoreCallFrame(b, call_stack_top, pc, b->LoadIndirect("Thread", "frame_base_", thread));
+  b->StoreIndirect("Thread", "call_stack_top_", thread, b->Add(call_stack_top, b->ConstInt32(1)));
+  b->StoreIndirect("Thread", "frame_base_", thread,
+  b->              LoadIndirect("Thread", "value_stack_top_", thread));
+}
+
+void FunctionBuilder::EmitPopCall(TR::IlBuilder* b) {
+  auto* thread = b->Load("thread");
+  auto* call_stack_top = b->Sub(
+                         b->    LoadIndirect("Thread", "call_stack_top_", thread),
+                         b->    ConstInt32(1));
+
+  b->StoreIndirect("Thread", "call_stack_top_", thread, call_stack_top);
+  b->StoreIndirect("Thread", "frame_base_", thread,
+  b->              LoadIndirect("CallFrame", "frame_base", CallFrameAddress(b, call_stack_top)));
+}
+
+TR::IlValue* FunctionBuilder::CallFrameAddress(TR::IlBuilder* b, TR::IlValue* index) {
+  return b->IndexAt(typeDictionary()->PointerTo("CallFrame"),
+         b->       LoadIndirect("Thread", "call_stack_data_", b->Load("thread")),
+                   index);
+}
+
+void FunctionBuilder::EmitStoreCallFrame(TR::IlBuilder* b, TR::IlValue* index, const uint8_t* return_pc,
+                                         TR::IlValue* frame_base) {
+  auto* frame = CallFrameAddress(b, index);
+  b->StoreIndirect("CallFrame", "return_offset", frame, b->ConstInt32(return_pc - GetIstream()));
+  b->StoreIndirect("CallFrame", "frame_base", frame, frame_base);
+}
+
+/**
+ * Small callees are inlined unless they are already being compiled, as their
+ * code would then be inlined endlessly.
+ */
+bool FunctionBuilder::ShouldInline(interp::DefinedFunc* callee) const {
+  if (inline_frame_ != nullptr && inline_frame_->depth >= kMaxInlineDepth) {
+    return false;
+  }
+
+  if (callee == fn_) {
+    return false;
+  }
+
+  for (auto* frame = inline_frame_; frame != nullptr; frame = frame->caller) {
+    if (frame->fn == callee) {
+      return false;
+    }
+  }
+
+  return callee->size <= kMaxInlineSize;
+}
+
+/**
+ * @brief Generate a call whose callee is inlined
+ *
+ * The arguments stay on the operand stack, where the callee's code finds them as
+ * its params. It is emitted like the rest of the function, except that its
+ * returns branch back to the caller.
+ *
+ * The frames of the inlined calls are only pushed to the call stack when needed
+ * (see EmitInlineFramesPush), but calling the callee must still trap if the call
+ * stack has no room left for them.
+ */
+void FunctionBuilder::EmitInlineCall(TR::BytecodeBuilder* b, interp::DefinedFunc* callee, const uint8_t* return_pc) {
+  Index depth = (inline_frame_ != nullptr ? inline_frame_->depth : 0) + 1;
+  auto* thread = b->Load("thread");
+
+  EmitTrapIf(b,
+  b->        UnsignedGreaterThan(
+  b->            Add(
+  b->                LoadIndirect("Thread", "call_stack_top_", thread),
+  b->                ConstInt32(depth)),
+  b->            LoadIndirect("Thread", "call_stack_size_", thread)),
+  b->        Const(static_cast<Result_t>(interp::Result::TrapCallStackExhausted)),
+             return_pc);
+
+  // Like that of a call, the frame base of the callee is just above its
+  // arguments
+  inline_frames_.emplace_back(inline_frame_, callee, return_pc, depth, Stack(b)->Height());
+  b->AddFallThroughBuilder(GetTargetBuilder(b, &GetIstream()[callee->offset], &inline_frames_.back()));
+}
+
+/**
+ * @brief Generate pushes of the frames of a chain of inlined calls to the call stack
+ *
+ * The interpreter has these frames on its call stack while running the
+ * callees. Inlined code only needs them when it traps or calls a function, as
+ * that is when the call stack can be observed (e.g. in a stack trace). There is
+ * always room for them, as EmitInlineCall checked it.
+ */
+void FunctionBuilder::EmitInlineFramesPush(TR::IlBuilder* b, const InlineFrame* frame) {
+  if (frame == nullptr) {
+    return;
+  }
+
+  auto* thread = b->Load("thread");
+  auto* call_stack_top = b->LoadIndirect("Thread", "call_stack_top_", thread);
+
+  // The innermost call is pushed last
+  for (auto* f = frame; f != nullptr; f = f->caller) {
+    EmitStoreCallFrame(b,
+    b->                Add(call_stack_top, b->ConstInt32(f->depth - 1)),
+                       f->return_pc,
+                       FrameBase(b, f->caller));
+  }
+
+  b->StoreIndirect("Thread", "call_stack_top_", thread,
+  b->              Add(call_stack_top, b->ConstInt32(frame->depth)));
+  b->StoreIndirect("Thread", "frame_base_", thread, FrameBase(b, frame));
+}
+
+void FunctionBuilder::EmitInlineFramesPop(TR::IlBuilder* b, const InlineFrame* frame) {
+  if (frame == nullptr) {
+    return;
+  }
+
+  auto* thread = b->Load("thread");
+  b->StoreIndirect("Thread", "call_stack_top_", thread,
+  b->              Sub(
+  b->                  LoadIndirect("Thread", "call_stack_top_", thread),
+  b->                  ConstInt32(frame->depth)));
+  b->StoreIndirect("Thread", "frame_base_", thread, b->Load("frame_base"));
+}
+
+/**
+ * @brief Generate the position in the interpreter stack of the frame base of an inlined call
+ * @param frame is the inlined call, or nullptr for the function itself
+ */
+TR::IlValue* FunctionBuilder::FrameBase(TR::IlBuilder* b, const InlineFrame* frame) {
+  if (frame == nullptr) {
+    return b->Load("frame_base");
+  }
+
+  return b->Add(b->Load("frame_base"), b->ConstInt32(frame->frame_base));
+}
+
+/**
+ * @brief Generate a return of a trap
+ *
+ * If pc is given, it is recorded as the location of the trap. A trap in inlined
+ * code also gets the frames of the inlined calls pushed, so the call stack is
+ * the same as if the callees had been called.
+ */
 void FunctionBuilder::EmitTrap(TR::IlBuilder* b, TR::IlValue* result, const uint8_t* pc) {
   if (pc != nullptr) {
-    b->StoreAt(b->ConstAddress(&thread_->pc_),
-               b->ConstInt32(pc - thread_->GetIstream()));
+    EmitInlineFramesPush(b, inline_frame_);
+    b->StoreIndirect("Thread", "pc_", b->Load("thread"),
+                     b->ConstInt32(pc - GetIstream()));
   }
 
   b->Return(result);
@@ -567,8 +1271,130 @@ TR::IlValue* FunctionBuilder::EmitIsNan<double>(TR::IlBuilder* b, TR::IlValue* v
          b->           ConstInt64(0x7ff0000000000000ULL));
 }
 
+/**
+ * @brief Generate a branch-free population count
+ *
+ * JitBuilder has no service for the popcnt instruction, so the bits are summed
+ * in parallel: first in pairs, then nibbles and bytes, and the byte counts are
+ * finally added together by a multiplication. This software sequence is a
+ * deliberate fallback; it should be replaced by a single instruction once
+ * JitBuilder exposes one.
+ */
+template <typename T>
+TR::IlValue* FunctionBuilder::EmitPopcnt(TR::IlBuilder* b, TR::IlValue* value) {
+  static_assert(std::is_integral<T>::value, "EmitPopcnt only works on integral types");
+  using U = typename std::make_unsigned<T>::type;
+
+  const U m1 = static_cast<U>(0x5555555555555555ULL);
+  const U m2 = static_cast<U>(0x3333333333333333ULL);
+  const U m4 = static_cast<U>(0x0f0f0f0f0f0f0f0fULL);
+  const U h01 = static_cast<U>(0x0101010101010101ULL);
+
+  auto* x = b->Sub(value,
+            b->    And(
+            b->        UnsignedShiftR(value, b->ConstInt32(1)),
+            b->        Const(static_cast<T>(m1))));
+  x = b->Add(
+      b->    And(x, b->Const(static_cast<T>(m2))),
+      b->    And(
+      b->        UnsignedShiftR(x, b->ConstInt32(2)),
+      b->        Const(static_cast<T>(m2))));
+  x = b->And(
+      b->    Add(x, b->UnsignedShiftR(x, b->ConstInt32(4))),
+      b->    Const(static_cast<T>(m4)));
+
+  return b->UnsignedShiftR(
+         b->               Mul(x, b->Const(static_cast<T>(h01))),
+         b->               ConstInt32(static_cast<int32_t>(sizeof(T) * 8 - 8)));
+}
+
+/**
+ * @brief Generate a branch-free count of leading zeros
+ *
+ * The highest set bit is smeared into all lower bits, which leaves exactly the
+ * leading zeros unset. Like EmitPopcnt, this is a fallback for the lzcnt/bsr
+ * instructions, which JitBuilder does not expose.
+ */
+template <typename T>
+TR::IlValue* FunctionBuilder::EmitClz(TR::IlBuilder* b, TR::IlValue* value) {
+  auto* x = value;
+  for (int32_t shift = 1; shift < static_cast<int32_t>(sizeof(T) * 8); shift *= 2) {
+    x = b->Or(x, b->UnsignedShiftR(x, b->ConstInt32(shift)));
+  }
+
+  return EmitPopcnt<T>(b, b->Xor(x, b->Const(static_cast<T>(-1))));
+}
+
+/**
+ * @brief Generate a branch-free count of trailing zeros
+ *
+ * `~x & (x - 1)` has exactly the trailing zeros of `x` set (all bits for 0).
+ * This stands in for tzcnt/bsf, which JitBuilder does not expose either.
+ */
+template <typename T>
+TR::IlValue* FunctionBuilder::EmitCtz(TR::IlBuilder* b, TR::IlValue* value) {
+  return EmitPopcnt<T>(b,
+         b->           And(
+         b->               Xor(value, b->Const(static_cast<T>(-1))),
+         b->               Sub(value, b->Const(static_cast<T>(1)))));
+}
+
+/**
+ * @brief Generate f{32,64}.min or f{32,64}.max
+ *
+ * A NaN operand yields that operand made quiet (the lhs taking precedence). For
+ * equal operands, the sign bits are combined so that min(0, -0) is -0 and
+ * max(0, -0) is 0. The generated code should be equivalent to:
+ *
+ * auto result = is_min ? (lhs < rhs ? lhs : rhs) : (lhs > rhs ? lhs : rhs);
+ * if (lhs == rhs) result = is_min ? bits(lhs) | bits(rhs) : bits(lhs) & bits(rhs);
+ * if (isnan(rhs)) result = bits(rhs) | quiet_nan_bit;
+ * if (isnan(lhs)) result = bits(lhs) | quiet_nan_bit;
+ */
+template <typename T>
+TR::IlValue* FunctionBuilder::EmitFloatMinMax(TR::IlBuilder* b, TR::IlValue* lhs, TR::IlValue* rhs, bool is_min) {
+  static_assert(std::is_floating_point<T>::value, "EmitFloatMinMax only works on floating point types");
+  using Bits = typename std::conditional<sizeof(T) == 4, int32_t, int64_t>::type;
+
+  auto* float_type = b->typeDictionary()->toIlType<T>();
+  auto* bits_type = b->typeDictionary()->toIlType<Bits>();
+  auto quiet_nan_bit = static_cast<Bits>(Bits(1) << (std::numeric_limits<T>::digits - 2));
+
+  auto* result = b->Copy(rhs);
+
+  TR::IlBuilder* take_lhs = nullptr;
+  b->IfThen(&take_lhs, is_min ? b->LessThan(lhs, rhs) : b->GreaterThan(lhs, rhs));
+  take_lhs->StoreOver(result, lhs);
+
+  TR::IlBuilder* equal = nullptr;
+  b->IfThen(&equal, b->EqualTo(lhs, rhs));
+  auto* lhs_bits = equal->CoerceTo(bits_type, lhs);
+  auto* rhs_bits = equal->CoerceTo(bits_type, rhs);
+  equal->StoreOver(result,
+  equal->          CoerceTo(float_type,
+                            is_min ? equal->Or(lhs_bits, rhs_bits) : equal->And(lhs_bits, rhs_bits)));
+
+  TR::IlBuilder* rhs_nan = nullptr;
+  b->IfThen(&rhs_nan, EmitIsNan<T>(b, rhs));
+  rhs_nan->StoreOver(result,
+  rhs_nan->          CoerceTo(float_type,
+  rhs_nan->                   Or(
+  rhs_nan->                      CoerceTo(bits_type, rhs),
+  rhs_nan->                      Const(quiet_nan_bit))));
+
+  TR::IlBuilder* lhs_nan = nullptr;
+  b->IfThen(&lhs_nan, EmitIsNan<T>(b, lhs));
+  lhs_nan->StoreOver(result,
+  lhs_nan->          CoerceTo(float_type,
+  lhs_nan->                   Or(
+  lhs_nan->                      CoerceTo(bits_type, lhs),
+  lhs_nan->                      Const(quiet_nan_bit))));
+
+  return result;
+}
+
 template <typename ToType, typename FromType>
-void FunctionBuilder::EmitTruncation(TR::IlBuilder* b, const uint8_t* pc) {
+void FunctionBuilder::EmitTruncation(TR::BytecodeBuilder* b, const uint8_t* pc) {
   static_assert(std::is_floating_point<FromType>::value, "FromType in EmitTruncation call must be a floating point type");
 
   auto* value = Pop(b, TypeFieldName<FromType>());
@@ -596,7 +1422,7 @@ void FunctionBuilder::EmitTruncation(TR::IlBuilder* b, const uint8_t* pc) {
   auto* new_value = std::is_unsigned<ToType>::value ? b->UnsignedConvertTo(target_type, value)
                                                     : b->ConvertTo(target_type, value);
 
-  Push(b, TypeFieldName<ToType>(), new_value, pc);
+  Push(b, TypeFieldName<ToType>(), new_value);
 }
 
 /**
@@ -608,7 +1434,7 @@ void FunctionBuilder::EmitTruncation(TR::IlBuilder* b, const uint8_t* pc) {
  * the target type.
  */
 template <typename ToType, typename FromType>
-void FunctionBuilder::EmitUnsignedTruncation(TR::IlBuilder* b, const uint8_t* pc) {
+void FunctionBuilder::EmitUnsignedTruncation(TR::BytecodeBuilder* b, const uint8_t* pc) {
   static_assert(std::is_floating_point<FromType>::value, "FromType in EmitTruncation call must be a floating point type");
   static_assert(std::is_integral<ToType>::value, "ToType in EmitUnsignedTruncation call must be an integer type");
   static_assert(std::is_unsigned<ToType>::value, "ToType in EmitUnsignedTruncation call must be unsigned");
@@ -634,7 +1460,80 @@ void FunctionBuilder::EmitUnsignedTruncation(TR::IlBuilder* b, const uint8_t* pc
   auto* target_type = b->typeDictionary()->toIlType<ToType>();
   auto* new_value = b->UnsignedConvertTo(target_type, b->ConvertTo(Int64, value));
 
-  Push(b, TypeFieldName<ToType>(), new_value, pc);
+  Push(b, TypeFieldName<ToType>(), new_value);
+}
+
+/**
+ * @brief Generate a saturating truncation (the `trunc_{s,u}:sat` family)
+ *
+ * NaN converts to 0 and out of range values to the closest bound of the target
+ * type. Both bounds of the range converting without saturation are powers of two
+ * and thus exactly representable in either floating-point type. The generated
+ * code should be equivalent to:
+ *
+ * ToType result = 0;
+ * if (value >= upper) result = max;
+ * if (value < lower) result = min;  // only needed for signed targets
+ * if (value >= lower && value < upper) result = (ToType)value;
+ */
+template <typename ToType, typename FromType>
+void FunctionBuilder::EmitSaturatingTruncation(TR::BytecodeBuilder* b) {
+  static_assert(std::is_floating_point<FromType>::value, "FromType in EmitSaturatingTruncation call must be a floating point type");
+  static_assert(std::is_integral<ToType>::value, "ToType in EmitSaturatingTruncation call must be an integer type");
+
+  // JitBuilder constants are always signed
+  using SignedType = typename std::make_signed<ToType>::type;
+
+  auto* value = Pop(b, TypeFieldName<FromType>());
+  auto* target_type = b->typeDictionary()->toIlType<ToType>();
+
+  const FromType upper = std::ldexp(FromType(1), std::numeric_limits<ToType>::digits);
+  const FromType lower = std::is_signed<ToType>::value ? -upper : FromType(0);
+
+  auto* result = b->Copy(b->Const(static_cast<SignedType>(0)));
+
+  TR::IlBuilder* too_large = nullptr;
+  b->IfThen(&too_large, b->GreaterOrEqualTo(value, b->Const(upper)));
+  too_large->StoreOver(result,
+  too_large->          Const(static_cast<SignedType>(std::numeric_limits<ToType>::max())));
+
+  if (std::is_signed<ToType>::value) {
+    TR::IlBuilder* too_small = nullptr;
+    b->IfThen(&too_small, b->LessThan(value, b->Const(lower)));
+    too_small->StoreOver(result,
+    too_small->          Const(static_cast<SignedType>(std::numeric_limits<ToType>::min())));
+  }
+
+  // Unsigned values in (-1, 0) also truncate to 0, so they can saturate instead
+  TR::IlBuilder* in_range = nullptr;
+  b->IfThen(&in_range,
+  b->       And(
+  b->           GreaterOrEqualTo(value, b->Const(lower)),
+  b->           LessThan(value, b->Const(upper))));
+
+  if (std::is_signed<ToType>::value) {
+    in_range->StoreOver(result, in_range->ConvertTo(target_type, value));
+  } else if (sizeof(ToType) < sizeof(int64_t)) {
+    in_range->StoreOver(result,
+    in_range->          UnsignedConvertTo(target_type, in_range->ConvertTo(Int64, value)));
+  } else {
+    // Values of 2^63 and above don't fit a signed 64-bit conversion. They are
+    // converted with 2^63 subtracted and the top bit is set afterwards.
+    const FromType two_63 = std::ldexp(FromType(1), 63);
+
+    TR::IlBuilder* low_half = nullptr;
+    TR::IlBuilder* high_half = nullptr;
+    in_range->IfThenElse(&low_half, &high_half,
+    in_range->           LessThan(value, in_range->Const(two_63)));
+
+    low_half->StoreOver(result, low_half->ConvertTo(Int64, value));
+    high_half->StoreOver(result,
+    high_half->          Xor(
+    high_half->              ConvertTo(Int64, high_half->Sub(value, high_half->Const(two_63))),
+    high_half->              ConstInt64(std::numeric_limits<int64_t>::min())));
+  }
+
+  Push(b, TypeFieldName<ToType>(), result);
 }
 
 template <typename T>
@@ -643,37 +1542,162 @@ TR::IlValue* FunctionBuilder::CalculateShiftAmount(TR::IlBuilder* b, TR::IlValue
          b->                  And(amount, b->Const(static_cast<T>(sizeof(T) * 8 - 1))));
 }
 
+TR::BytecodeBuilder* FunctionBuilder::GetTargetBuilder(TR::BytecodeBuilder* b, const uint8_t* target, const InlineFrame* frame) {
+  if (auto* target_builder = FindTargetBuilder(target, frame)) {
+    return target_builder;
+  }
+
+  Stack(b)->CopyValues(b);
+  int32_t next_index = static_cast<int32_t>(workItems_.size());
+  workItems_.emplace_back(OrphanBytecodeBuilder(next_index,
+                                                const_cast<char*>(ReadOpcodeAt(target).GetName())),
+                          target, false, frame);
+  return workItems_[next_index].builder;
+}
+
+TR::BytecodeBuilder* FunctionBuilder::FindTargetBuilder(const uint8_t* target, const InlineFrame* frame) {
+  auto it = std::find_if(workItems_.cbegin(), workItems_.cend(), [&](const BytecodeWorkItem& item) {
+    return !item.is_table_entry && target == item.pc && frame == item.frame;
+  });
+  return it != workItems_.cend() ? it->builder : nullptr;
+}
+
+/**
+ * @brief Generate the entry of a function compiled for on-stack replacement
+ *
+ * The interpreter enters such a function at a loop header, with the params,
+ * locals and operand stack of the function on the interpreter stack. They are
+ * loaded into the state the header is entered with, like on a back edge, before
+ * jumping to it.
+ */
+bool FunctionBuilder::EmitOsrEntry(TR::IlBuilder* b, const uint8_t* header) {
+  auto* header_builder = FindTargetBuilder(header, nullptr);
+  if (header_builder == nullptr) {
+    return false;
+  }
+
+  auto* state = static_cast<OperandStack*>(header_builder->initialVMState());
+  if (state->Bottom() != static_cast<int32_t>(fn_->local_count)) {
+    return false;
+  }
+
+  b->Store("frame_base", b->LoadIndirect("Thread", "frame_base_", b->Load("thread")));
+
+  auto num_params = static_cast<int32_t>(fn_->param_and_local_types.size() - fn_->local_count);
+  for (Index i = 0; i < local_names_.size(); ++i) {
+    const char* type = TypeFieldName(fn_->param_and_local_types[i]);
+    b->Store(local_names_[i].c_str(),
+    b->      LoadIndirect("Value", type, StackSlotAddress(b, static_cast<int32_t>(i) - num_params)));
+  }
+
+  for (Index depth = state->Size(); depth > 0; --depth) {
+    auto* entry = state->Pick(depth);
+    b->StoreOver(entry->value,
+    b->          LoadIndirect("Value", entry->type,
+                              StackSlotAddress(b, state->Height() - static_cast<int32_t>(depth))));
+  }
+
+  b->Goto(header_builder);
+  return true;
+}
+
+void FunctionBuilder::EmitBrTableEntry(TR::BytecodeBuilder* b,
+                                       const uint8_t* istream,
+                                       const uint8_t* entry) {
+  using interp::IstreamOffset;  // needed by the WABT_TABLE_ENTRY_* macros
+
+  auto target = &istream[ReadUxAt<uint32_t>(entry + WABT_TABLE_ENTRY_OFFSET_OFFSET)];
+  auto drop_count = ReadUxAt<uint32_t>(entry + WABT_TABLE_ENTRY_DROP_OFFSET);
+  auto keep_count = ReadUxAt<uint8_t>(entry + WABT_TABLE_ENTRY_KEEP_OFFSET);
+
+  DropKeep(b, drop_count, keep_count);
+  b->AddFallThroughBuilder(GetTargetBuilder(b, target, inline_frame_));
+}
+
+Index FunctionBuilder::EmitRegisterOperands(TR::BytecodeBuilder* b, const uint8_t** pc) {
+  auto lhs = Pick(b, ReadU32(pc));
+  auto* lhs_value = b->Copy(lhs.value);
+  auto rhs = Pick(b, ReadU32(pc));
+  auto* rhs_value = b->Copy(rhs.value);
+  Index dest = ReadU32(pc);
+  uint8_t drop_count = ReadU8(pc);
+
+  DropKeep(b, drop_count, 0);
+  Push(b, lhs.type, lhs_value);
+  Push(b, rhs.type, rhs_value);
+  return dest;
+}
+
 bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
                            const uint8_t* istream,
                            const uint8_t* pc) {
   Opcode opcode = ReadOpcode(&pc);
   TR_ASSERT(!opcode.IsInvalid(), "Invalid opcode");
 
+  Index register_dest = 0;
+  if (env_->register_istream && interp::IsRegisterBinop(opcode)) {
+    register_dest = EmitRegisterOperands(b, &pc);
+  }
+
   switch (opcode) {
     case Opcode::Select: {
-      TR::IlBuilder* true_path = nullptr;
+      auto* condition = Pop(b, "i32");
+      auto false_value = Stack(b)->Pop();
+      auto true_value = Stack(b)->Pop();
+      auto* value = b->Copy(true_value.value);
+
       TR::IlBuilder* false_path = nullptr;
+      b->IfThen(&false_path, b->EqualTo(condition, b->ConstInt32(0)));
+      false_path->StoreOver(value, false_value.value);
 
-      b->IfThenElse(&true_path, &false_path, Pop(b, "i32"));
-      DropKeep(true_path, 1, 0);
-      DropKeep(false_path, 1, 1);
+      Push(b, true_value.type, value);
       break;
     }
 
     case Opcode::Br: {
       auto target = &istream[ReadU32(&pc)];
-      auto it = std::find_if(workItems_.cbegin(), workItems_.cend(), [&](const BytecodeWorkItem& b) {
-        return target == b.pc;
-      });
-      if (it != workItems_.cend()) {
-        b->AddFallThroughBuilder(it->builder);
-      } else {
+      // Backward branches are loop iterations
+      if (target < pc && CountsHotness()) {
+        EmitHotnessCount(b);
+      }
+      b->AddFallThroughBuilder(GetTargetBuilder(b, target, inline_frame_));
+      return true;
+    }
+
+    case Opcode::BrTable: {
+      // Every entry of the table gets its own builder performing the entry's
+      // DropKeep before branching to its target. These are selected with a
+      // switch on the key, the last entry being the default.
+      using interp::IstreamOffset;  // needed by WABT_TABLE_ENTRY_SIZE
+
+      Index num_targets = ReadU32(&pc);
+      auto table = &istream[ReadU32(&pc)];
+
+      b->Store("br_table_key", Pop(b, "i32"));
+
+      std::vector<TR::IlBuilder::JBCase*> cases;
+      cases.reserve(num_targets);
+      TR::BytecodeBuilder* default_builder = nullptr;
+
+      for (Index i = 0; i <= num_targets; ++i) {
         int32_t next_index = static_cast<int32_t>(workItems_.size());
-        workItems_.emplace_back(OrphanBytecodeBuilder(next_index,
-                                                      const_cast<char*>(ReadOpcodeAt(target).GetName())),
-                                target);
-        b->AddFallThroughBuilder(workItems_[next_index].builder);
+        workItems_.emplace_back(OrphanBytecodeBuilder(next_index, const_cast<char*>("br_table entry")),
+                                &table[i * WABT_TABLE_ENTRY_SIZE],
+                                true,
+                                inline_frame_);
+        auto* entry_builder = workItems_[next_index].builder;
+        b->AddSuccessorBuilder(&entry_builder);
+
+        if (i < num_targets) {
+          auto* case_builder = static_cast<TR::IlBuilder*>(entry_builder);
+          cases.push_back(b->MakeCase(static_cast<int32_t>(i), &case_builder, 0));
+        } else {
+          default_builder = entry_builder;
+        }
       }
+
+      auto* default_il_builder = static_cast<TR::IlBuilder*>(default_builder);
+      b->Switch("br_table_key", &default_il_builder, num_targets, cases.data());
       return true;
     }
 
@@ -681,6 +1705,14 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
     // transformed into a BrUnless. So, there's no need to handle it.
 
     case Opcode::Return:
+      if (inline_frame_ != nullptr) {
+        // The preceding DropKeep has already replaced the arguments by the
+        // results, so the caller simply continues after the call.
+        b->AddFallThroughBuilder(GetTargetBuilder(b, inline_frame_->return_pc, inline_frame_->caller));
+        return true;
+      }
+
+      SpillStack(b, Stack(b)->Size(), pc);
       b->Return(b->Const(static_cast<Result_t>(interp::Result::Ok)));
       return true;
 
@@ -690,30 +1722,30 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
 
     case Opcode::I32Const: {
       auto* val = b->ConstInt32(ReadU32(&pc));
-      Push(b, "i32", val, pc);
+      Push(b, "i32", val);
       break;
     }
 
     case Opcode::I64Const: {
       auto* val = b->ConstInt64(ReadU64(&pc));
-      Push(b, "i64", val, pc);
+      Push(b, "i64", val);
       break;
     }
 
     case Opcode::F32Const: {
       auto* val = b->ConstFloat(ReadUx<float>(&pc));
-      Push(b, "f32", val, pc);
+      Push(b, "f32", val);
       break;
     }
 
     case Opcode::F64Const: {
       auto* val = b->ConstDouble(ReadUx<double>(&pc));
-      Push(b, "f64", val, pc);
+      Push(b, "f64", val);
       break;
     }
 
     case Opcode::GetGlobal: {
-      interp::Global* g = thread_->env()->GetGlobal(ReadU32(&pc));
+      interp::Global* g = env_->GetGlobal(ReadU32(&pc));
 
       // The type of value stored in a global will never change, so we're safe
       // to use the current type of the global.
@@ -722,18 +1754,18 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       if (g->mutable_) {
         // TODO(thomasbc): Can the address of a Global change at runtime?
         auto* addr = b->Const(&g->typed_value.value);
-        Push(b, type_field, b->LoadIndirect("Value", type_field, addr), pc);
+        Push(b, type_field, b->LoadIndirect("Value", type_field, addr));
       } else {
         // With immutable globals, we can just substitute their actual value as
         // a constant at compile-time.
-        Push(b, type_field, Const(b, &g->typed_value), pc);
+        Push(b, type_field, Const(b, &g->typed_value));
       }
 
       break;
     }
 
     case Opcode::SetGlobal: {
-      interp::Global* g = thread_->env()->GetGlobal(ReadU32(&pc));
+      interp::Global* g = env_->GetGlobal(ReadU32(&pc));
       assert(g->mutable_);
 
       // See note for get_global
@@ -747,66 +1779,186 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
     }
 
     case Opcode::GetLocal: {
-      // note: to work around JitBuilder's lack of support unions as value types,
-      // just copy a field that's the size of the entire union
-      auto* local_addr = Pick(b, ReadU32(&pc));
-      Push(b, "i64", b->LoadIndirect("Value", "i64", local_addr), pc);
+      auto local = PickLocal(b, ReadU32(&pc));
+      Push(b, local.type, b->Copy(local.value));
       break;
     }
 
     case Opcode::SetLocal: {
-      // see note for GetLocal
-      auto* value = Pop(b, "i64");
-      auto* local_addr = Pick(b, ReadU32(&pc));
-      b->StoreIndirect("Value", "i64", local_addr, value);
+      auto value = Stack(b)->Pop();
+      PokeLocal(b, ReadU32(&pc), value.value);
       break;
     }
 
-    case Opcode::TeeLocal:
-      // see note for GetLocal
-      b->StoreIndirect("Value", "i64", Pick(b, ReadU32(&pc)), b->LoadIndirect("Value", "i64", Pick(b, 1)));
+    case Opcode::TeeLocal: {
+      auto value = Pick(b, 1);
+      PokeLocal(b, ReadU32(&pc), b->Copy(value.value));
       break;
+    }
 
     case Opcode::Call: {
-      auto th_addr = b->ConstAddress(thread_);
-      auto offset = b->ConstInt32(ReadU32(&pc));
-      auto current_pc = b->Const(pc);
+      interp::IstreamOffset target_offset = ReadU32(&pc);
+      auto* meta = &env_->jit_meta_.find(target_offset)->second;
+      auto* sig = env_->GetFuncSignature(meta->wasm_fn->sig_index);
 
-      b->Store("result",
-      b->      Call("CallHelper", 3, th_addr, offset, current_pc));
+      if (ShouldInline(meta->wasm_fn) && Stack(b)->Size() >= sig->param_types.size()) {
+        EmitInlineCall(b, meta->wasm_fn, pc);
+        return true;
+      }
 
-      // Don't pass the pc since a trap in a called function should not update the thread's pc
-      EmitCheckTrap(b, b->Load("result"), nullptr);
+      // The callee finds its arguments on the interpreter stack
+      SpillStack(b, sig->param_types.size(), pc);
+
+      // The frames of inlined callers must be on the call stack while the
+      // callee runs. They are left there if it traps, so traps from here on
+      // must not push them again.
+      auto* frame = inline_frame_;
+      EmitInlineFramesPush(b, frame);
+      inline_frame_ = nullptr;
+
+      // Once the callee is compiled, its entry point is stored in its JIT
+      // metadata (whose address never changes) and it can be called directly.
+      // Until then, CallHelper takes care of compiling or interpreting it.
+      static_assert(sizeof(meta->jit_fn) == sizeof(void*), "jit_fn must be loadable as a pointer");
+      auto* jit_fn = b->LoadAt(typeDictionary()->PointerTo(Address),
+                     b->       ConstAddress(&meta->jit_fn));
+
+      TR::IlBuilder* direct_call = nullptr;
+      TR::IlBuilder* helper_call = nullptr;
+      b->IfThenElse(&direct_call, &helper_call,
+      b->           NotEqualTo(jit_fn, b->ConstAddress(nullptr)));
+
+      // Don't pass the pc to EmitCheckTrap since a trap in a called function
+      // should not update the thread's pc
+      EmitPushCall(direct_call, pc);
+      direct_call->Store("result",
+      direct_call->      ComputedCall("JITedFunction", 2, jit_fn, direct_call->Load("thread")));
+      EmitCheckTrap(direct_call, direct_call->Load("result"), nullptr);
+      EmitPopCall(direct_call);
 
+      helper_call->Store("result",
+      helper_call->      Call("CallHelper", 3,
+      helper_call->           Load("thread"),
+      helper_call->           ConstInt32(target_offset),
+      helper_call->           Const(pc)));
+      EmitCheckTrap(helper_call, helper_call->Load("result"), nullptr);
+
+      inline_frame_ = frame;
+      EmitInlineFramesPop(b, frame);
+      EmitMemoryCacheReset(b);
+
+      DropKeep(b, sig->param_types.size(), 0);
+      ReloadResults(b, sig);
       break;
     }
 
     case Opcode::CallIndirect: {
-      auto th_addr = b->ConstAddress(thread_);
-      auto table_index = b->ConstInt32(ReadU32(&pc));
-      auto sig_index = b->ConstInt32(ReadU32(&pc));
+      Index table_index_value = ReadU32(&pc);
+      Index sig_index_value = ReadU32(&pc);
+      auto* sig = env_->GetFuncSignature(sig_index_value);
+
+      auto th_addr = b->Load("thread");
+      auto table_index = b->ConstInt32(table_index_value);
+      auto canonical_sig_index = b->ConstInt32(sig->canonical_index);
       auto entry_index = Pop(b, "i32");
       auto current_pc = b->Const(pc);
 
-      b->Store("result",
-      b->      Call("CallIndirectHelper", 5, th_addr, table_index, sig_index, entry_index, current_pc));
+      SpillStack(b, sig->param_types.size(), pc);
+
+      // See the note for call
+      auto* frame = inline_frame_;
+      EmitInlineFramesPush(b, frame);
+      inline_frame_ = nullptr;
+
+      // Table entries that were called before have their compiled target
+      // cached, which skips the lookup and signature check of the helper. The
+      // generated code should be equivalent to:
+      //
+      // callee = nullptr;
+      // if (cache->slots[0].entry_index == entry_index) callee = *cache->slots[0].jit_fn;
+      // else if (cache->slots[1].entry_index == entry_index) callee = *cache->slots[1].jit_fn;
+      // ...
+      // if (callee) { push call; callee(thread); pop call; }
+      // else CallIndirectHelper(..., cache);
+      //
+      // The cache is shared by all compilations of the call site, so
+      // recompiling the function (or inlining it elsewhere) keeps what it
+      // learnt.
+      auto* cache = &env_->call_indirect_caches_[pc - GetIstream()];
+      static_assert(sizeof(cache->slots[0].entry_index) == sizeof(Index) &&
+                    sizeof(cache->slots[0].jit_fn) == sizeof(void*) &&
+                    sizeof(*cache->slots[0].jit_fn.load()) == sizeof(void*),
+                    "cache slots must be loadable as plain values");
+
+      b->Store("callee", b->ConstAddress(nullptr));
+      TR::IlBuilder* probe = b;
+      for (auto& slot : cache->slots) {
+        TR::IlBuilder* hit = nullptr;
+        TR::IlBuilder* miss = nullptr;
+        probe->IfThenElse(&hit, &miss,
+        probe->           EqualTo(
+        probe->               LoadAt(typeDictionary()->PointerTo(Int32),
+        probe->                      ConstAddress(&slot.entry_index)),
+                              entry_index));
+        hit->Store("callee",
+        hit->      LoadAt(typeDictionary()->PointerTo(Address),
+        hit->             LoadAt(typeDictionary()->PointerTo(Address),
+        hit->                    ConstAddress(&slot.jit_fn))));
+        probe = miss;
+      }
+
+      auto* callee = b->Load("callee");
+      TR::IlBuilder* direct_call = nullptr;
+      TR::IlBuilder* helper_call = nullptr;
+      b->IfThenElse(&direct_call, &helper_call,
+      b->           NotEqualTo(callee, b->ConstAddress(nullptr)));
 
       // Don't pass the pc since a trap in a called function should not update the thread's pc
-      EmitCheckTrap(b, b->Load("result"), nullptr);
+      EmitPushCall(direct_call, pc);
+      direct_call->Store("result",
+      direct_call->      ComputedCall("JITedFunction", 2, callee, direct_call->Load("thread")));
+      EmitCheckTrap(direct_call, direct_call->Load("result"), nullptr);
+      EmitPopCall(direct_call);
+
+      helper_call->Store("result",
+      helper_call->      Call("CallIndirectHelper", 6, th_addr, table_index, canonical_sig_index, entry_index, current_pc,
+      helper_call->           ConstAddress(cache)));
+      EmitCheckTrap(helper_call, helper_call->Load("result"), nullptr);
+
+      inline_frame_ = frame;
+      EmitInlineFramesPop(b, frame);
+      EmitMemoryCacheReset(b);
 
+      DropKeep(b, sig->param_types.size(), 0);
+      ReloadResults(b, sig);
       break;
     }
 
     case Opcode::InterpCallHost: {
       Index func_index = ReadU32(&pc);
+      auto* sig = env_->GetFuncSignature(env_->GetFunc(func_index)->sig_index);
+
+      SpillStack(b, sig->param_types.size(), pc);
+
+      // See the note for call. The host function runs in the frame of the
+      // caller, so a trap still records the pc.
+      auto* frame = inline_frame_;
+      EmitInlineFramesPush(b, frame);
+      inline_frame_ = nullptr;
 
       b->Store("result",
       b->      Call("CallHostHelper", 2,
-      b->           ConstAddress(thread_),
+      b->           Load("thread"),
       b->           ConstInt32(func_index)));
 
       EmitCheckTrap(b, b->Load("result"), pc);
 
+      inline_frame_ = frame;
+      EmitInlineFramesPop(b, frame);
+      EmitMemoryCacheReset(b);
+
+      DropKeep(b, sig->param_types.size(), 0);
+      ReloadResults(b, sig);
       break;
     }
 
@@ -815,8 +1967,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i32",
       b->  ConvertTo(Int32,
-      b->            LoadAt(typeDictionary()->PointerTo(Int8), addr)),
-           pc);
+      b->            LoadAt(typeDictionary()->PointerTo(Int8), addr)));
       break;
     }
 
@@ -825,8 +1976,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i32",
       b->  UnsignedConvertTo(Int32,
-      b->                    LoadAt(typeDictionary()->PointerTo(Int8), addr)),
-           pc);
+      b->                    LoadAt(typeDictionary()->PointerTo(Int8), addr)));
       break;
     }
 
@@ -835,8 +1985,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i32",
       b->  ConvertTo(Int32,
-      b->            LoadAt(typeDictionary()->PointerTo(Int16), addr)),
-           pc);
+      b->            LoadAt(typeDictionary()->PointerTo(Int16), addr)));
       break;
     }
 
@@ -845,8 +1994,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i32",
       b->  UnsignedConvertTo(Int32,
-      b->                    LoadAt(typeDictionary()->PointerTo(Int16), addr)),
-           pc);
+      b->                    LoadAt(typeDictionary()->PointerTo(Int16), addr)));
       break;
     }
 
@@ -855,8 +2003,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i64",
       b->  ConvertTo(Int64,
-      b->            LoadAt(typeDictionary()->PointerTo(Int8), addr)),
-           pc);
+      b->            LoadAt(typeDictionary()->PointerTo(Int8), addr)));
       break;
     }
 
@@ -865,8 +2012,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i64",
       b->  UnsignedConvertTo(Int64,
-      b->                    LoadAt(typeDictionary()->PointerTo(Int8), addr)),
-           pc);
+      b->                    LoadAt(typeDictionary()->PointerTo(Int8), addr)));
       break;
     }
 
@@ -875,8 +2021,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i64",
       b->  ConvertTo(Int64,
-      b->            LoadAt(typeDictionary()->PointerTo(Int16), addr)),
-           pc);
+      b->            LoadAt(typeDictionary()->PointerTo(Int16), addr)));
       break;
     }
 
@@ -885,8 +2030,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i64",
       b->  UnsignedConvertTo(Int64,
-      b->                    LoadAt(typeDictionary()->PointerTo(Int16), addr)),
-           pc);
+      b->                    LoadAt(typeDictionary()->PointerTo(Int16), addr)));
       break;
     }
 
@@ -895,8 +2039,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i64",
       b->  ConvertTo(Int64,
-      b->            LoadAt(typeDictionary()->PointerTo(Int32), addr)),
-           pc);
+      b->            LoadAt(typeDictionary()->PointerTo(Int32), addr)));
       break;
     }
 
@@ -905,8 +2048,146 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       Push(b,
            "i64",
       b->  UnsignedConvertTo(Int64,
-      b->                    LoadAt(typeDictionary()->PointerTo(Int32), addr)),
-           pc);
+      b->                    LoadAt(typeDictionary()->PointerTo(Int32), addr)));
+      break;
+    }
+
+    case Opcode::I32AtomicLoad8U:
+      EmitAtomicLoad<int8_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicLoad16U:
+      EmitAtomicLoad<int16_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicLoad:
+      EmitAtomicLoad<int32_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicLoad8U:
+      EmitAtomicLoad<int8_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicLoad16U:
+      EmitAtomicLoad<int16_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicLoad32U:
+      EmitAtomicLoad<int32_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicLoad:
+      EmitAtomicLoad<int64_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicStore8:
+      EmitAtomicStore<int8_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicStore16:
+      EmitAtomicStore<int16_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicStore:
+      EmitAtomicStore<int32_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicStore8:
+      EmitAtomicStore<int8_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicStore16:
+      EmitAtomicStore<int16_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicStore32:
+      EmitAtomicStore<int32_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicStore:
+      EmitAtomicStore<int64_t, int64_t>(b, &pc);
+      break;
+
+#define ATOMIC_RMW(rmwop)                                                \
+  case Opcode::I32AtomicRmw##rmwop:                                      \
+    EmitAtomicRmw<int32_t, int32_t>(b, &pc, AtomicRmwOp::rmwop);         \
+    break;                                                               \
+  case Opcode::I64AtomicRmw##rmwop:                                      \
+    EmitAtomicRmw<int64_t, int64_t>(b, &pc, AtomicRmwOp::rmwop);         \
+    break;                                                               \
+  case Opcode::I32AtomicRmw8U##rmwop:                                    \
+    EmitAtomicRmw<int8_t, int32_t>(b, &pc, AtomicRmwOp::rmwop);          \
+    break;                                                               \
+  case Opcode::I32AtomicRmw16U##rmwop:                                   \
+    EmitAtomicRmw<int16_t, int32_t>(b, &pc, AtomicRmwOp::rmwop);         \
+    break;                                                               \
+  case Opcode::I64AtomicRmw8U##rmwop:                                    \
+    EmitAtomicRmw<int8_t, int64_t>(b, &pc, AtomicRmwOp::rmwop);          \
+    break;                                                               \
+  case Opcode::I64AtomicRmw16U##rmwop:                                   \
+    EmitAtomicRmw<int16_t, int64_t>(b, &pc, AtomicRmwOp::rmwop);         \
+    break;                                                               \
+  case Opcode::I64AtomicRmw32U##rmwop:                                   \
+    EmitAtomicRmw<int32_t, int64_t>(b, &pc, AtomicRmwOp::rmwop);         \
+    break /* no semicolon */
+
+    ATOMIC_RMW(Add);
+    ATOMIC_RMW(Sub);
+    ATOMIC_RMW(And);
+    ATOMIC_RMW(Or);
+    ATOMIC_RMW(Xor);
+    ATOMIC_RMW(Xchg);
+
+#undef ATOMIC_RMW
+
+    case Opcode::I32AtomicRmwCmpxchg:
+      EmitAtomicCmpxchg<int32_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicRmwCmpxchg:
+      EmitAtomicCmpxchg<int64_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicRmw8UCmpxchg:
+      EmitAtomicCmpxchg<int8_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I32AtomicRmw16UCmpxchg:
+      EmitAtomicCmpxchg<int16_t, int32_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicRmw8UCmpxchg:
+      EmitAtomicCmpxchg<int8_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicRmw16UCmpxchg:
+      EmitAtomicCmpxchg<int16_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::I64AtomicRmw32UCmpxchg:
+      EmitAtomicCmpxchg<int32_t, int64_t>(b, &pc);
+      break;
+
+    case Opcode::CurrentMemory: {
+      Index memory_id = ReadU32(&pc);
+      Push(b, "i32",
+      b->     Call("CurrentMemoryHelper", 2,
+      b->          Load("thread"),
+      b->          ConstInt32(memory_id)));
+      break;
+    }
+
+    case Opcode::GrowMemory: {
+      Index memory_id = ReadU32(&pc);
+      auto* grow_pages = Pop(b, "i32");
+      Push(b, "i32",
+      b->     Call("GrowMemoryHelper", 3,
+      b->          Load("thread"),
+      b->          ConstInt32(memory_id),
+                   grow_pages));
+
+      // Growing may move the memory, so any cached base address is now stale
+      EmitMemoryCacheReset(b);
       break;
     }
 
@@ -914,8 +2195,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       auto* addr = EmitMemoryPreAccess<int32_t>(b, &pc);
       Push(b,
            "i32",
-      b->  LoadAt(typeDictionary()->PointerTo(Int32), addr),
-           pc);
+      b->  LoadAt(typeDictionary()->PointerTo(Int32), addr));
       break;
     }
 
@@ -923,8 +2203,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       auto* addr = EmitMemoryPreAccess<int64_t>(b, &pc);
       Push(b,
            "i64",
-      b->  LoadAt(typeDictionary()->PointerTo(Int64), addr),
-           pc);
+      b->  LoadAt(typeDictionary()->PointerTo(Int64), addr));
       break;
     }
 
@@ -932,8 +2211,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       auto* addr = EmitMemoryPreAccess<float>(b, &pc);
       Push(b,
            "f32",
-      b->  LoadAt(typeDictionary()->PointerTo(Float), addr),
-           pc);
+      b->  LoadAt(typeDictionary()->PointerTo(Float), addr));
       break;
     }
 
@@ -941,8 +2219,7 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       auto* addr = EmitMemoryPreAccess<double>(b, &pc);
       Push(b,
            "f64",
-      b->  LoadAt(typeDictionary()->PointerTo(Double), addr),
-           pc);
+      b->  LoadAt(typeDictionary()->PointerTo(Double), addr));
       break;
     }
 
@@ -1026,6 +2303,14 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       EmitIntRemainder<int32_t>(b, pc);
       break;
 
+    case Opcode::I32DivU:
+      EmitUnsignedIntDivide<int32_t>(b, pc);
+      break;
+
+    case Opcode::I32RemU:
+      EmitUnsignedIntRemainder<int32_t>(b, pc);
+      break;
+
     case Opcode::I32And:
       EmitBinaryOp<int32_t>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
         return b->And(lhs, rhs);
@@ -1082,6 +2367,24 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       });
       break;
 
+    case Opcode::I32Clz:
+      EmitUnaryOp<int32_t>(b, pc, [&](TR::IlValue* val) {
+        return EmitClz<int32_t>(b, val);
+      });
+      break;
+
+    case Opcode::I32Ctz:
+      EmitUnaryOp<int32_t>(b, pc, [&](TR::IlValue* val) {
+        return EmitCtz<int32_t>(b, val);
+      });
+      break;
+
+    case Opcode::I32Popcnt:
+      EmitUnaryOp<int32_t>(b, pc, [&](TR::IlValue* val) {
+        return EmitPopcnt<int32_t>(b, val);
+      });
+      break;
+
     case Opcode::I32Eqz:
       EmitUnaryOp<int32_t, int>(b, pc, [&](TR::IlValue* val) {
         return b->EqualTo(val, b->ConstInt32(0));
@@ -1174,6 +2477,14 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       EmitIntRemainder<int64_t>(b, pc);
       break;
 
+    case Opcode::I64DivU:
+      EmitUnsignedIntDivide<int64_t>(b, pc);
+      break;
+
+    case Opcode::I64RemU:
+      EmitUnsignedIntRemainder<int64_t>(b, pc);
+      break;
+
     case Opcode::I64And:
       EmitBinaryOp<int64_t>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
         return b->And(lhs, rhs);
@@ -1230,6 +2541,24 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       });
       break;
 
+    case Opcode::I64Clz:
+      EmitUnaryOp<int64_t>(b, pc, [&](TR::IlValue* val) {
+        return EmitClz<int64_t>(b, val);
+      });
+      break;
+
+    case Opcode::I64Ctz:
+      EmitUnaryOp<int64_t>(b, pc, [&](TR::IlValue* val) {
+        return EmitCtz<int64_t>(b, val);
+      });
+      break;
+
+    case Opcode::I64Popcnt:
+      EmitUnaryOp<int64_t>(b, pc, [&](TR::IlValue* val) {
+        return EmitPopcnt<int64_t>(b, val);
+      });
+      break;
+
     case Opcode::I64Eqz:
       EmitUnaryOp<int64_t, int>(b, pc, [&](TR::IlValue* val) {
         return b->EqualTo(val, b->ConstInt64(0));
@@ -1351,6 +2680,42 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       });
       break;
 
+    case Opcode::F32Ceil:
+      EmitUnaryOp<float>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f32_ceil", 1, value);
+      });
+      break;
+
+    case Opcode::F32Floor:
+      EmitUnaryOp<float>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f32_floor", 1, value);
+      });
+      break;
+
+    case Opcode::F32Trunc:
+      EmitUnaryOp<float>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f32_trunc", 1, value);
+      });
+      break;
+
+    case Opcode::F32Nearest:
+      EmitUnaryOp<float>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f32_nearest", 1, value);
+      });
+      break;
+
+    case Opcode::F32Min:
+      EmitBinaryOp<float>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
+        return EmitFloatMinMax<float>(b, lhs, rhs, true);
+      });
+      break;
+
+    case Opcode::F32Max:
+      EmitBinaryOp<float>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
+        return EmitFloatMinMax<float>(b, lhs, rhs, false);
+      });
+      break;
+
     case Opcode::F32Copysign:
       EmitBinaryOp<float>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
         return b->Call("f32_copysign", 2, lhs, rhs);
@@ -1448,6 +2813,42 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       });
       break;
 
+    case Opcode::F64Ceil:
+      EmitUnaryOp<double>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f64_ceil", 1, value);
+      });
+      break;
+
+    case Opcode::F64Floor:
+      EmitUnaryOp<double>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f64_floor", 1, value);
+      });
+      break;
+
+    case Opcode::F64Trunc:
+      EmitUnaryOp<double>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f64_trunc", 1, value);
+      });
+      break;
+
+    case Opcode::F64Nearest:
+      EmitUnaryOp<double>(b, pc, [&](TR::IlValue* value) {
+        return b->Call("f64_nearest", 1, value);
+      });
+      break;
+
+    case Opcode::F64Min:
+      EmitBinaryOp<double>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
+        return EmitFloatMinMax<double>(b, lhs, rhs, true);
+      });
+      break;
+
+    case Opcode::F64Max:
+      EmitBinaryOp<double>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
+        return EmitFloatMinMax<double>(b, lhs, rhs, false);
+      });
+      break;
+
     case Opcode::F64Copysign:
       EmitBinaryOp<double>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
         return b->Call("f64_copysign", 2, lhs, rhs);
@@ -1493,142 +2894,137 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
     case Opcode::I32WrapI64: {
       auto* value = Pop(b, "i64");
       Push(b, "i32",
-      b->  ConvertTo(Int32, value),
-           pc);
+      b->  ConvertTo(Int32, value));
       break;
     }
 
     case Opcode::I64ExtendSI32: {
       auto* value = Pop(b, "i32");
       Push(b, "i64",
-      b->  ConvertTo(Int64, value),
-           pc);
+      b->  ConvertTo(Int64, value));
       break;
     }
 
     case Opcode::I64ExtendUI32: {
       auto* value = Pop(b, "i32");
       Push(b, "i64",
-      b->  UnsignedConvertTo(Int64, value),
-           pc);
+      b->  UnsignedConvertTo(Int64, value));
       break;
     }
 
     case Opcode::F32DemoteF64: {
       auto* value = Pop(b, "f64");
       Push(b, "f32",
-      b->  ConvertTo(Float, value),
-           pc);
+      b->  ConvertTo(Float, value));
       break;
     }
 
     case Opcode::F64PromoteF32: {
       auto* value = Pop(b, "f32");
       Push(b, "f64",
-      b->  ConvertTo(Double, value),
-           pc);
+      b->  ConvertTo(Double, value));
       break;
     }
 
     case Opcode::I32Extend8S: {
       auto* value = b->ConvertTo(Int32, b->ConvertTo(Int8, Pop(b, "i32")));
-      Push(b, "i32", value, pc);
+      Push(b, "i32", value);
       break;
     }
 
     case Opcode::I32Extend16S: {
       auto* value = b->ConvertTo(Int32, b->ConvertTo(Int16, Pop(b, "i32")));
-      Push(b, "i32", value, pc);
+      Push(b, "i32", value);
       break;
     }
 
     case Opcode::I64Extend8S: {
-      auto* value = b->ConvertTo(Int32, b->ConvertTo(Int8, Pop(b, "i32")));
-      Push(b, "i32", value, pc);
+      auto* value = b->ConvertTo(Int64, b->ConvertTo(Int8, Pop(b, "i64")));
+      Push(b, "i64", value);
       break;
     }
 
     case Opcode::I64Extend16S: {
-      auto* value = b->ConvertTo(Int32, b->ConvertTo(Int16, Pop(b, "i32")));
-      Push(b, "i32", value, pc);
+      auto* value = b->ConvertTo(Int64, b->ConvertTo(Int16, Pop(b, "i64")));
+      Push(b, "i64", value);
       break;
     }
 
     case Opcode::I64Extend32S: {
       auto* value = b->ConvertTo(Int64, b->ConvertTo(Int32, Pop(b, "i64")));
-      Push(b, "i64", value, pc);
+      Push(b, "i64", value);
       break;
     }
 
     case Opcode::F32ConvertSI32: {
       auto* value = b->ConvertTo(Float, Pop(b, "i32"));
-      Push(b, "f32", value, pc);
+      Push(b, "f32", value);
       break;
     }
 
     case Opcode::F32ConvertUI32: {
       auto* value = b->UnsignedConvertTo(Float, Pop(b, "i32"));
-      Push(b, "f32", value, pc);
+      Push(b, "f32", value);
       break;
     }
 
     case Opcode::F32ConvertSI64: {
       auto* value = b->ConvertTo(Float, Pop(b, "i64"));
-      Push(b, "f32", value, pc);
+      Push(b, "f32", value);
       break;
     }
 
     case Opcode::F32ConvertUI64: {
       auto* value = b->UnsignedConvertTo(Float, Pop(b, "i64"));
-      Push(b, "f32", value, pc);
+      Push(b, "f32", value);
       break;
     }
 
     case Opcode::F64ConvertSI32: {
       auto* value = b->ConvertTo(Double, Pop(b, "i32"));
-      Push(b, "f64", value, pc);
+      Push(b, "f64", value);
       break;
     }
 
     case Opcode::F64ConvertUI32: {
       auto* value = b->UnsignedConvertTo(Double, Pop(b, "i32"));
-      Push(b, "f64", value, pc);
+      Push(b, "f64", value);
       break;
     }
 
     case Opcode::F64ConvertSI64: {
       auto* value = b->ConvertTo(Double, Pop(b, "i64"));
-      Push(b, "f64", value, pc);
+      Push(b, "f64", value);
       break;
     }
 
     case Opcode::F64ConvertUI64: {
       auto* value = b->UnsignedConvertTo(Double, Pop(b, "i64"));
-      Push(b, "f64", value, pc);
+      Push(b, "f64", value);
       break;
     }
 
     case Opcode::F32ReinterpretI32: {
       auto* value = b->CoerceTo(Float, Pop(b, "i32"));
-      Push(b, "f32", value, pc);
+      Push(b, "f32", value);
       break;
     }
 
     case Opcode::I32ReinterpretF32: {
       auto* value = b->CoerceTo(Int32, Pop(b, "f32"));
-      Push(b, "i32", value, pc);
+      Push(b, "i32", value);
       break;
     }
 
     case Opcode::F64ReinterpretI64: {
       auto* value = b->CoerceTo(Double, Pop(b, "i64"));
-      Push(b, "f64", value, pc);
+      Push(b, "f64", value);
       break;
     }
 
     case Opcode::I64ReinterpretF64: {
       auto* value = b->CoerceTo(Int64, Pop(b, "f64"));
-      Push(b, "i64", value, pc);
+      Push(b, "i64", value);
       break;
     }
 
@@ -1666,29 +3062,63 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
 //      EmitTruncation<uint64_t, double>(b, pc);
 //      break;
 
+    case Opcode::I32TruncSSatF32:
+      EmitSaturatingTruncation<int32_t, float>(b);
+      break;
+
+    case Opcode::I32TruncUSatF32:
+      EmitSaturatingTruncation<uint32_t, float>(b);
+      break;
+
+    case Opcode::I32TruncSSatF64:
+      EmitSaturatingTruncation<int32_t, double>(b);
+      break;
+
+    case Opcode::I32TruncUSatF64:
+      EmitSaturatingTruncation<uint32_t, double>(b);
+      break;
+
+    case Opcode::I64TruncSSatF32:
+      EmitSaturatingTruncation<int64_t, float>(b);
+      break;
+
+    case Opcode::I64TruncUSatF32:
+      EmitSaturatingTruncation<uint64_t, float>(b);
+      break;
+
+    case Opcode::I64TruncSSatF64:
+      EmitSaturatingTruncation<int64_t, double>(b);
+      break;
+
+    case Opcode::I64TruncUSatF64:
+      EmitSaturatingTruncation<uint64_t, double>(b);
+      break;
+
     case Opcode::InterpAlloca: {
-      auto pInt32 = typeDictionary()->PointerTo(Int32);
-      auto* stack_top_addr = b->ConstAddress(&thread_->value_stack_top_);
-      auto* stack_base_addr = b->ConstAddress(thread_->value_stack_.data());
+      Index count = ReadU32(&pc);
+
+      if (inline_frame_ != nullptr) {
+        // The params of an inlined callee are the arguments tracked on the
+        // operand stack, so its locals are tracked right above them.
+        auto* callee = inline_frame_->fn;
+        for (Index i = callee->param_and_local_types.size() - count; i < callee->param_and_local_types.size(); ++i) {
+          interp::TypedValue zero(callee->param_and_local_types[i]);
+          zero.value.i64 = 0;
+          Push(b, TypeFieldName(zero.type), Const(b, &zero));
+        }
 
-      auto* old_value_stack_top = b->LoadAt(pInt32, stack_top_addr);
-      auto* count = b->ConstInt32(ReadU32(&pc));
-      auto* stack_top =  b->Add(old_value_stack_top, count);
-      b->StoreAt(stack_top_addr, stack_top);
+        break;
+      }
 
-      EmitTrapIf(b,
-      b->        UnsignedGreaterOrEqualTo(
-                     stack_top,
-      b->            Const(static_cast<int32_t>(thread_->value_stack_.size()))),
-      b->        Const(static_cast<Result_t>(interp::Result::TrapValueStackExhausted)),
-                 pc);
+      // Locals are only ever accessed by this function, so their slots are
+      // reserved without being written to the interpreter stack.
+      Stack(b)->Alloca(count);
 
-      TR::IlBuilder* set_zero = nullptr;
-      b->ForLoopUp("i", &set_zero, old_value_stack_top, stack_top, b->Const(1));
-      set_zero->StoreIndirect("Value", "i64",
-      set_zero->              IndexAt(pValueType_, stack_base_addr,
-      set_zero->                      Load("i")),
-      set_zero->              ConstInt64(0));
+      for (Index i = fn_->param_and_local_types.size() - count; i < fn_->param_and_local_types.size(); ++i) {
+        interp::TypedValue zero(fn_->param_and_local_types[i]);
+        zero.value.i64 = 0;
+        b->Store(local_names_[i].c_str(), Const(b, &zero));
+      }
 
       break;
     }
@@ -1696,18 +3126,8 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
     case Opcode::InterpBrUnless: {
       auto target = &istream[ReadU32(&pc)];
       auto condition = Pop(b, "i32");
-      auto it = std::find_if(workItems_.begin(), workItems_.end(), [&](const BytecodeWorkItem& b) {
-        return target == b.pc;
-      });
-      if (it != workItems_.end()) {
-        b->IfCmpEqualZero(&it->builder, condition);
-      } else {
-        int32_t next_index = static_cast<int32_t>(workItems_.size());
-        workItems_.emplace_back(OrphanBytecodeBuilder(next_index,
-                                                      const_cast<char*>(ReadOpcodeAt(target).GetName())),
-                                target);
-        b->IfCmpEqualZero(&workItems_[next_index].builder, condition);
-      }
+      auto* target_builder = GetTargetBuilder(b, target, inline_frame_);
+      b->IfCmpEqualZero(&target_builder, condition);
       break;
     }
 
@@ -1722,6 +3142,32 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       break;
     }
 
+    // Superinstructions only save dispatches in the interpreter, so they are
+    // compiled like the instructions they replace.
+    case Opcode::InterpGetLocalGetLocal:
+    case Opcode::InterpGetLocalGetLocalI32Add:
+    case Opcode::InterpGetLocalI32Const:
+    case Opcode::InterpGetLocalI32ConstI32Add: {
+      auto local = PickLocal(b, ReadU32(&pc));
+      Push(b, local.type, b->Copy(local.value));
+
+      if (opcode == Opcode::InterpGetLocalGetLocal ||
+          opcode == Opcode::InterpGetLocalGetLocalI32Add) {
+        local = PickLocal(b, ReadU32(&pc));
+        Push(b, local.type, b->Copy(local.value));
+      } else {
+        Push(b, "i32", b->ConstInt32(ReadU32(&pc)));
+      }
+
+      if (opcode == Opcode::InterpGetLocalGetLocalI32Add ||
+          opcode == Opcode::InterpGetLocalI32ConstI32Add) {
+        EmitBinaryOp<int32_t>(b, pc, [&](TR::IlValue* lhs, TR::IlValue* rhs) {
+          return b->Add(lhs, rhs);
+        });
+      }
+      break;
+    }
+
     case Opcode::Nop:
       break;
 
@@ -1729,11 +3175,16 @@ bool FunctionBuilder::Emit(TR::BytecodeBuilder* b,
       return false;
   }
 
+  if (register_dest != 0) {
+    auto value = Stack(b)->Pop();
+    Poke(b, register_dest, value.value);
+  }
+
   int32_t next_index = static_cast<int32_t>(workItems_.size());
 
   workItems_.emplace_back(OrphanBytecodeBuilder(next_index,
                                                 const_cast<char*>(ReadOpcodeAt(pc).GetName())),
-                          pc);
+                          pc, false, inline_frame_);
   b->AddFallThroughBuilder(workItems_[next_index].builder);
 
   return true;
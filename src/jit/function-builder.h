@@ -17,91 +17,206 @@
 #ifndef FUNCTIONBUILDER_HPP
 #define FUNCTIONBUILDER_HPP
 
+#include "operand-stack.h"
 #include "type-dictionary.h"
 #include "ilgen/BytecodeBuilder.hpp"
 #include "ilgen/MethodBuilder.hpp"
-#include "ilgen/VirtualMachineOperandStack.hpp"
 
 #include "src/interp.h"
 
+#include <deque>
+#include <map>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 namespace wabt {
 namespace jit {
 
 class FunctionBuilder : public TR::MethodBuilder {
  public:
-  FunctionBuilder(interp::Thread* thread, interp::DefinedFunc* fn, TypeDictionary* types);
+  /**
+   * @param osr_offset is the offset of a loop header to compile the function for
+   *        on-stack replacement at, or kInvalidIstreamOffset for a normal entry
+   * @param tier is 1 for code counting its hotness, 2 for optimized code
+   */
+  FunctionBuilder(interp::Environment* env,
+                  interp::DefinedFunc* fn,
+                  TypeDictionary* types,
+                  interp::IstreamOffset osr_offset = interp::kInvalidIstreamOffset,
+                  unsigned tier = 1);
   bool buildIL() override;
 
   /**
-   * @brief Generate push to the interpreter stack
+   * @brief Generate push to the operand stack
    * @param b is the builder object used to generate the code
    * @param type is the name of the field in the Value union corresponding to the type of the value being pushed
    * @param value is the IlValue representing the value being pushed
    */
-  void Push(TR::IlBuilder* b, const char* type, TR::IlValue* value, const uint8_t* pc);
+  void Push(TR::BytecodeBuilder* b, const char* type, TR::IlValue* value);
 
   /**
-   * @brief Generate pop from the interpreter stack
+   * @brief Generate pop from the operand stack
    * @param b is the builder object used to generate the code
    * @param type is the name of the field in the Value union corresponding to the type of the value being popped
    * @return an IlValue representing the popped value
    */
-  TR::IlValue* Pop(TR::IlBuilder* b, const char* type);
+  TR::IlValue* Pop(TR::BytecodeBuilder* b, const char* type);
 
   /**
-   * @brief Drop a number of values from the interpreter stack, optionally keeping the top value of the stack
+   * @brief Drop a number of values from the operand stack, optionally keeping the top value of the stack
    * @param b is the builder object used to generate the code
    * @param drop_count is the number of values to drop from the stack
    * @param keep_count is 1 to keep the top value intact and 0 otherwise
    */
-  void DropKeep(TR::IlBuilder* b, uint32_t drop_count, uint8_t keep_count);
+  void DropKeep(TR::BytecodeBuilder* b, uint32_t drop_count, uint8_t keep_count);
 
   /**
-   * @brief Generate load of pointer to a vlue on the interpreter stack by an index
+   * @brief Generate load of a value on the operand stack by an index
    * @param b is the builder object used to generate the code
    * @param depth is the index from the top of the stack
-   * @return and IlValue representing a pointer to the value on the stack
+   * @return the stack entry holding the value
    *
-   * JitBuilder does not currently represent unions as value types. This a problem
-   * for this function because it cannot simply return an IlValue representing
-   * the union. As workaround, it will generate a load of the *base address* of
-   * the union, instead of loading the union directly. This behaviour differs
-   * from `Thread::Pick()` and users must take this into account.
+   * Params and locals are not tracked on the operand stack. Picking them
+   * generates a load of the JitBuilder local holding them.
    */
-  TR::IlValue* Pick(TR::IlBuilder* b, Index depth);
+  OperandStack::Entry Pick(TR::BytecodeBuilder* b, Index depth);
+
+  /**
+   * @brief Generate store to a value on the operand stack by an index
+   * @param b is the builder object used to generate the code
+   * @param depth is the index from the top of the stack
+   * @param value is the IlValue representing the new value
+   */
+  void Poke(TR::BytecodeBuilder* b, Index depth, TR::IlValue* value);
+
+  /**
+   * @brief Generate load of a param or local
+   * @param b is the builder object used to generate the code
+   * @param offset is the position of the param or local from the frame base
+   *               of the function (or of the inlined call) being emitted
+   * @return the stack entry holding the value
+   */
+  OperandStack::Entry PickLocal(TR::BytecodeBuilder* b, Index offset);
+
+  /**
+   * @brief Generate store to a param or local
+   * @param b is the builder object used to generate the code
+   * @param offset is the position of the param or local from the frame base
+   *               of the function (or of the inlined call) being emitted
+   * @param value is the IlValue representing the new value
+   */
+  void PokeLocal(TR::BytecodeBuilder* b, Index offset, TR::IlValue* value);
 
  private:
+  /**
+   * @brief A call whose callee is inlined into the function
+   *
+   * The code of the callee is emitted with its own work items, as the same pc
+   * may be emitted for several call sites (or for the function itself).
+   */
+  struct InlineFrame {
+    const InlineFrame* caller;  // nullptr if called by the function itself
+    interp::DefinedFunc* fn;
+    const uint8_t* return_pc;
+    Index depth;                // number of inlined calls up to and including this one
+    int32_t frame_base;         // position of the callee's frame base, see OperandStack
+
+    InlineFrame(const InlineFrame* caller, interp::DefinedFunc* fn, const uint8_t* return_pc, Index depth,
+                int32_t frame_base)
+      : caller(caller), fn(fn), return_pc(return_pc), depth(depth), frame_base(frame_base) {}
+  };
+
   struct BytecodeWorkItem {
     TR::BytecodeBuilder* builder;
     const uint8_t* pc;
 
-    BytecodeWorkItem(TR::BytecodeBuilder* builder, const uint8_t* pc)
-      : builder(builder), pc(pc) {}
+    // true if pc points to a br_table entry rather than to an instruction
+    bool is_table_entry;
+
+    // the inlined call the code belongs to, or nullptr for the function itself
+    const InlineFrame* frame;
+
+    BytecodeWorkItem(TR::BytecodeBuilder* builder, const uint8_t* pc, bool is_table_entry = false,
+                     const InlineFrame* frame = nullptr)
+      : builder(builder), pc(pc), is_table_entry(is_table_entry), frame(frame) {}
   };
 
+  const uint8_t* GetIstream() const { return env_->istream_->data.data(); }
+
   template <typename T>
   const char* TypeFieldName() const;
 
   const char* TypeFieldName(Type t) const;
 
+  TR::IlType* IlTypeOf(Type t) const;
+
   TR::IlValue* Const(TR::IlBuilder* b, const interp::TypedValue* v) const;
 
+  OperandStack* Stack(TR::BytecodeBuilder* b) const;
+  TR::IlValue* StackSlotAddress(TR::IlBuilder* b, int32_t position);
+  Index LocalIndex(int32_t position) const;
+  void SpillStack(TR::BytecodeBuilder* b, Index count, const uint8_t* pc);
+  void ReloadResults(TR::BytecodeBuilder* b, const interp::FuncSignature* sig);
+
   template <typename T, typename TResult = T, typename TOpHandler>
-  void EmitBinaryOp(TR::IlBuilder* b, const uint8_t* pc, TOpHandler h);
+  void EmitBinaryOp(TR::BytecodeBuilder* b, const uint8_t* pc, TOpHandler h);
 
   template <typename T, typename TResult = T, typename TOpHandler>
-  void EmitUnaryOp(TR::IlBuilder* b, const uint8_t* pc, TOpHandler h);
+  void EmitUnaryOp(TR::BytecodeBuilder* b, const uint8_t* pc, TOpHandler h);
 
   template <typename T>
-  void EmitIntDivide(TR::IlBuilder* b, const uint8_t* pc);
+  void EmitIntDivide(TR::BytecodeBuilder* b, const uint8_t* pc);
 
   template <typename T>
-  void EmitIntRemainder(TR::IlBuilder* b, const uint8_t* pc);
+  void EmitIntRemainder(TR::BytecodeBuilder* b, const uint8_t* pc);
 
   template <typename T>
-  TR::IlValue* EmitMemoryPreAccess(TR::IlBuilder* b, const uint8_t** pc);
+  void EmitUnsignedIntDivide(TR::BytecodeBuilder* b, const uint8_t* pc);
+
+  template <typename T>
+  void EmitUnsignedIntRemainder(TR::BytecodeBuilder* b, const uint8_t* pc);
+
+  struct MemoryCache {
+    std::string base;
+    std::string size;
+  };
+
+  const MemoryCache& GetMemoryCache(Index memory_id);
+  void EmitMemoryCacheReset(TR::IlBuilder* b);
+
+  template <typename T>
+  TR::IlValue* EmitMemoryPreAccess(TR::BytecodeBuilder* b, const uint8_t** pc, bool atomic = false);
+
+  enum class AtomicRmwOp { Add, Sub, And, Or, Xor, Xchg };
+
+  template <typename T>
+  TR::IlValue* EmitZeroExtendToInt64(TR::IlBuilder* b, TR::IlValue* value);
+  template <typename T>
+  TR::IlValue* EmitWrapFromInt64(TR::IlBuilder* b, TR::IlValue* value);
+
+  template <typename MemType, typename T>
+  void EmitAtomicLoad(TR::BytecodeBuilder* b, const uint8_t** pc);
+  template <typename MemType, typename T>
+  void EmitAtomicStore(TR::BytecodeBuilder* b, const uint8_t** pc);
+  template <typename MemType, typename T>
+  void EmitAtomicRmw(TR::BytecodeBuilder* b, const uint8_t** pc, AtomicRmwOp op);
+  template <typename MemType, typename T>
+  void EmitAtomicCmpxchg(TR::BytecodeBuilder* b, const uint8_t** pc);
+
+  bool CountsHotness() const;
+  void EmitHotnessCount(TR::IlBuilder* b);
+
+  void EmitPushCall(TR::IlBuilder* b, const uint8_t* pc);
+  void EmitPopCall(TR::IlBuilder* b);
+  TR::IlValue* CallFrameAddress(TR::IlBuilder* b, TR::IlValue* index);
+  void EmitStoreCallFrame(TR::IlBuilder* b, TR::IlValue* index, const uint8_t* return_pc, TR::IlValue* frame_base);
+
+  bool ShouldInline(interp::DefinedFunc* callee) const;
+  void EmitInlineCall(TR::BytecodeBuilder* b, interp::DefinedFunc* callee, const uint8_t* return_pc);
+  void EmitInlineFramesPush(TR::IlBuilder* b, const InlineFrame* frame);
+  void EmitInlineFramesPop(TR::IlBuilder* b, const InlineFrame* frame);
+  TR::IlValue* FrameBase(TR::IlBuilder* b, const InlineFrame* frame);
 
   void EmitTrap(TR::IlBuilder* b, TR::IlValue* result, const uint8_t* pc);
   void EmitCheckTrap(TR::IlBuilder* b, TR::IlValue* result, const uint8_t* pc);
@@ -110,10 +225,22 @@ class FunctionBuilder : public TR::MethodBuilder {
   template <typename F>
   TR::IlValue* EmitIsNan(TR::IlBuilder* b, TR::IlValue* value);
 
+  template <typename T>
+  TR::IlValue* EmitFloatMinMax(TR::IlBuilder* b, TR::IlValue* lhs, TR::IlValue* rhs, bool is_min);
+
+  template <typename T>
+  TR::IlValue* EmitPopcnt(TR::IlBuilder* b, TR::IlValue* value);
+  template <typename T>
+  TR::IlValue* EmitClz(TR::IlBuilder* b, TR::IlValue* value);
+  template <typename T>
+  TR::IlValue* EmitCtz(TR::IlBuilder* b, TR::IlValue* value);
+
+  template <typename ToType, typename FromType>
+  void EmitTruncation(TR::BytecodeBuilder* b, const uint8_t* pc);
   template <typename ToType, typename FromType>
-  void EmitTruncation(TR::IlBuilder* b, const uint8_t* pc);
+  void EmitUnsignedTruncation(TR::BytecodeBuilder* b, const uint8_t* pc);
   template <typename ToType, typename FromType>
-  void EmitUnsignedTruncation(TR::IlBuilder* b, const uint8_t* pc);
+  void EmitSaturatingTruncation(TR::BytecodeBuilder* b);
 
   template <typename>
   TR::IlValue* CalculateShiftAmount(TR::IlBuilder* b, TR::IlValue* amount);
@@ -122,21 +249,86 @@ class FunctionBuilder : public TR::MethodBuilder {
 
   static Result_t CallHelper(wabt::interp::Thread* th, wabt::interp::IstreamOffset offset, uint8_t* current_pc);
 
-  static Result_t CallIndirectHelper(wabt::interp::Thread* th, Index table_index, Index sig_index, Index entry_index, uint8_t* current_pc);
+  static Result_t CallIndirectHelper(wabt::interp::Thread* th, Index table_index, Index canonical_sig_index, Index entry_index, uint8_t* current_pc,
+                                     interp::Environment::CallIndirectCache* cache);
+
+  static void AddToCallIndirectCache(interp::Environment::CallIndirectCache* cache, Index entry_index,
+                                     std::atomic<interp::Environment::JITedFunction>* jit_fn);
 
   static Result_t CallHostHelper(wabt::interp::Thread* th, Index func_index);
 
-  static void* MemoryTranslationHelper(interp::Thread* th, uint32_t memory_id, uint64_t address, uint32_t size);
+  static void* MemoryBaseHelper(interp::Thread* th, uint32_t memory_id);
+
+  static uint64_t MemorySizeHelper(interp::Thread* th, uint32_t memory_id);
+
+  static uint32_t CurrentMemoryHelper(interp::Thread* th, uint32_t memory_id);
+
+  static uint32_t GrowMemoryHelper(interp::Thread* th, uint32_t memory_id, uint32_t grow_pages);
+
+  static void TierUpHelper(interp::Environment* env, interp::Environment::JitMeta* meta);
+
+  // The atomic helpers take and return values zero-extended to 64 bits
+  template <typename MemType, AtomicRmwOp op>
+  static uint64_t AtomicRmwHelper(void* address, uint64_t value);
+
+  template <typename MemType>
+  static uint64_t AtomicCmpxchgHelper(void* address, uint64_t expected, uint64_t replacement);
+
+  template <typename MemType>
+  static void AtomicStoreHelper(void* address, uint64_t value);
 
   std::vector<BytecodeWorkItem> workItems_;
 
-  interp::Thread* thread_;
+  // A deque, as work items point to its elements
+  std::deque<InlineFrame> inline_frames_;
+
+  // The inlined call of the work item being emitted
+  const InlineFrame* inline_frame_ = nullptr;
+
+  interp::Environment* env_;
   interp::DefinedFunc* fn_;
+  interp::IstreamOffset osr_offset_;
+  unsigned tier_;
+  std::string name_;
+
+  // Names of the JitBuilder locals holding the params and locals of the function
+  std::vector<std::string> local_names_;
+
+  // Locals caching the base address and size of each memory used by the function
+  std::map<Index, MemoryCache> memory_caches_;
+  std::vector<TR::IlBuilder*> memory_cache_resets_;
 
   TR::IlType* const valueType_;
   TR::IlType* const pValueType_;
 
+  /**
+   * @brief Get the builder for the code at a given pc, creating it if needed
+   *
+   * Must be called before adding the edge from `b` to the target, as the values
+   * of `b`'s operand stack are copied when a new target is created.
+   */
+  TR::BytecodeBuilder* GetTargetBuilder(TR::BytecodeBuilder* b, const uint8_t* target, const InlineFrame* frame);
+
+  /**
+   * @brief Get the builder branches to the code at a given pc go to
+   * @param frame is the inlined call the code belongs to, or nullptr for the function itself
+   * @return the builder or nullptr if there is no branch to that pc
+   */
+  TR::BytecodeBuilder* FindTargetBuilder(const uint8_t* target, const InlineFrame* frame);
+
+  bool EmitOsrEntry(TR::IlBuilder* b, const uint8_t* header);
+
+  /**
+   * @brief Push copies of the operands of a binary operator of a register istream
+   * @param pc points just after the opcode and is advanced past the immediates
+   * @return the depth of the local to store the result to, or 0 to push it
+   *
+   * The operator itself is then generated like in a stack istream.
+   */
+  Index EmitRegisterOperands(TR::BytecodeBuilder* b, const uint8_t** pc);
+
   bool Emit(TR::BytecodeBuilder* b, const uint8_t* istream, const uint8_t* pc);
+  void EmitBrTableEntry(TR::BytecodeBuilder* b, const uint8_t* istream, const uint8_t* entry);
 };
 
 }
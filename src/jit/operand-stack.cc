@@ -0,0 +1,120 @@
+/*
+ * Copyright 2017 wasmjit-omr project participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "operand-stack.h"
+#include "ilgen/IlBuilder.hpp"
+#include "infra/Assert.hpp"
+
+#include <algorithm>
+
+namespace wabt {
+namespace jit {
+
+TR::VirtualMachineState* OperandStack::MakeCopy() {
+  return new OperandStack(*this);
+}
+
+/**
+ * @brief Generate code to make the values of another state hold the values of this one
+ *
+ * Both states must describe the same stack shape, which WebAssembly validation
+ * guarantees for all edges into a label. A value of this state may be tracked in
+ * a *different* slot of the target state (e.g. after a DropKeep), in which case
+ * storing over the target's value first would clobber it before it is read. Such
+ * values are copied before any store happens.
+ */
+void OperandStack::MergeInto(TR::VirtualMachineState* other, TR::IlBuilder* b) {
+  auto* target = static_cast<OperandStack*>(other);
+  TR_ASSERT(target->bottom_ == bottom_ && target->entries_.size() == entries_.size(),
+            "Merging operand stacks of different shapes");
+
+  std::vector<TR::IlValue*> sources;
+  sources.reserve(entries_.size());
+
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    auto* value = entries_[i].value;
+
+    if (value != target->entries_[i].value && target->Tracks(value)) {
+      value = b->Copy(value);
+    }
+
+    sources.push_back(value);
+  }
+
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (sources[i] != target->entries_[i].value) {
+      b->StoreOver(target->entries_[i].value, sources[i]);
+    }
+  }
+}
+
+void OperandStack::Push(const char* type, TR::IlValue* value) {
+  entries_.emplace_back(type, value);
+}
+
+OperandStack::Entry OperandStack::Pop() {
+  TR_ASSERT(!entries_.empty(), "Popping a value that is not tracked on the operand stack");
+  auto entry = entries_.back();
+  entries_.pop_back();
+  return entry;
+}
+
+OperandStack::Entry* OperandStack::Pick(Index depth) {
+  if (depth > entries_.size()) {
+    return nullptr;
+  }
+
+  return &entries_[entries_.size() - depth];
+}
+
+/**
+ * The dropped values may include slots that are not tracked (e.g. the params and
+ * locals of the function when returning). In that case the tracked part of the stack
+ * simply starts at the new stack height.
+ */
+void OperandStack::DropKeep(uint32_t drop_count, uint8_t keep_count) {
+  TR_ASSERT(keep_count <= 1, "Invalid keep count");
+  TR_ASSERT(keep_count <= entries_.size(), "Keeping a value that is not tracked on the operand stack");
+
+  int32_t new_height = Height() - static_cast<int32_t>(drop_count);
+
+  if (new_height - keep_count >= bottom_) {
+    entries_.erase(entries_.end() - drop_count - keep_count, entries_.end() - keep_count);
+  } else {
+    entries_.erase(entries_.begin(), entries_.end() - keep_count);
+    bottom_ = new_height - keep_count;
+  }
+}
+
+void OperandStack::Alloca(Index count) {
+  TR_ASSERT(entries_.empty(), "Allocating slots below tracked values");
+  bottom_ += static_cast<int32_t>(count);
+}
+
+void OperandStack::CopyValues(TR::IlBuilder* b) {
+  for (auto& entry : entries_) {
+    entry.value = b->Copy(entry.value);
+  }
+}
+
+bool OperandStack::Tracks(TR::IlValue* value) const {
+  return std::any_of(entries_.cbegin(), entries_.cend(), [&](const Entry& e) {
+    return e.value == value;
+  });
+}
+
+}
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2017 wasmjit-omr project participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef OPERANDSTACK_HPP
+#define OPERANDSTACK_HPP
+
+#include "ilgen/VirtualMachineState.hpp"
+
+#include "src/common.h"
+
+#include <vector>
+
+namespace TR {
+class IlBuilder;
+class IlValue;
+}
+
+namespace wabt {
+namespace jit {
+
+/**
+ * @brief Compile-time model of the interpreter value stack of a JITed function
+ *
+ * Instead of pushing and popping values through `Thread::value_stack_`, the JIT
+ * tracks the IlValue currently held by each stack slot. Values only have to be
+ * written to the interpreter stack when something outside of the JITed function
+ * needs to see them (e.g. the arguments of a call or the results of the function).
+ *
+ * Slots are identified by their position relative to the top of the interpreter
+ * stack on entry to the function (the "frame base"). The arguments of the function
+ * therefore live at negative positions. Slots below `Bottom()` (the params and
+ * locals) are not tracked. Those of inlined callees are, as they live above the
+ * caller's values.
+ */
+class OperandStack : public TR::VirtualMachineState {
+ public:
+  struct Entry {
+    const char* type;   // name of the field in the Value union for the value
+    TR::IlValue* value;
+
+    Entry(const char* type, TR::IlValue* value) : type(type), value(value) {}
+  };
+
+  OperandStack() = default;
+
+  TR::VirtualMachineState* MakeCopy() override;
+  void MergeInto(TR::VirtualMachineState* other, TR::IlBuilder* b) override;
+
+  void Push(const char* type, TR::IlValue* value);
+  Entry Pop();
+
+  /**
+   * @brief Get the entry at a given depth from the top of the stack
+   * @return a pointer to the entry or nullptr if the slot is not tracked
+   */
+  Entry* Pick(Index depth);
+
+  void DropKeep(uint32_t drop_count, uint8_t keep_count);
+
+  /**
+   * @brief Reserve untracked slots at the top of the stack
+   *
+   * Used for the locals of the function, which are held in JitBuilder locals.
+   */
+  void Alloca(Index count);
+
+  /**
+   * @brief Replace all tracked values by fresh copies
+   *
+   * Merging into a builder stores over the values of its initial state. Giving a
+   * new branch target its own copies ensures such stores cannot be observed by
+   * the code following the branch.
+   */
+  void CopyValues(TR::IlBuilder* b);
+
+  int32_t Height() const { return bottom_ + static_cast<int32_t>(entries_.size()); }
+  int32_t Bottom() const { return bottom_; }
+  Index Size() const { return entries_.size(); }
+
+ private:
+  bool Tracks(TR::IlValue* value) const;
+
+  int32_t bottom_ = 0;
+  std::vector<Entry> entries_;
+};
+
+}
+}
+
+#endif // OPERANDSTACK_HPP
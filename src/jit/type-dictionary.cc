@@ -17,6 +17,8 @@
 #include "type-dictionary.h"
 #include "src/interp.h"
 
+#include <cstddef>
+
 wabt::jit::TypeDictionary::TypeDictionary() : TR::TypeDictionary() {
     using namespace wabt::interp;
     DefineUnion("Value");
@@ -25,4 +27,22 @@ wabt::jit::TypeDictionary::TypeDictionary() : TR::TypeDictionary() {
     UnionField("Value", "f32", toIlType<float>());
     UnionField("Value", "f64", toIlType<double>());
     CloseUnion("Value");
+
+    DefineStruct("CallFrame");
+    DefineField("CallFrame", "return_offset", toIlType<IstreamOffset>(), offsetof(Thread::CallFrame, return_offset));
+    DefineField("CallFrame", "frame_base", toIlType<uint32_t>(), offsetof(Thread::CallFrame, frame_base));
+    CloseStruct("CallFrame", sizeof(Thread::CallFrame));
+
+    // The parts of a Thread accessed by JITed code, which gets the thread it
+    // runs on as its argument
+    DefineStruct("Thread");
+    DefineField("Thread", "value_stack_data_", PointerTo("Value"), offsetof(Thread, value_stack_data_));
+    DefineField("Thread", "value_stack_size_", toIlType<uint32_t>(), offsetof(Thread, value_stack_size_));
+    DefineField("Thread", "call_stack_data_", PointerTo("CallFrame"), offsetof(Thread, call_stack_data_));
+    DefineField("Thread", "call_stack_size_", toIlType<uint32_t>(), offsetof(Thread, call_stack_size_));
+    DefineField("Thread", "value_stack_top_", toIlType<uint32_t>(), offsetof(Thread, value_stack_top_));
+    DefineField("Thread", "call_stack_top_", toIlType<uint32_t>(), offsetof(Thread, call_stack_top_));
+    DefineField("Thread", "frame_base_", toIlType<uint32_t>(), offsetof(Thread, frame_base_));
+    DefineField("Thread", "pc_", toIlType<IstreamOffset>(), offsetof(Thread, pc_));
+    CloseStruct("Thread", sizeof(Thread));
 }
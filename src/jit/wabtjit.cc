@@ -20,12 +20,22 @@
 
 #include "Jit.hpp"
 
+#include <mutex>
+
 namespace wabt {
 namespace jit {
 
-JITedFunction compile(interp::Thread* thread, interp::DefinedFunc* fn) {
+JITedFunction compile(interp::Environment* env,
+                      interp::DefinedFunc* fn,
+                      interp::IstreamOffset osr_offset,
+                      unsigned tier) {
+  // JitBuilder keeps global compiler state, so only one function can be
+  // compiled at a time
+  static std::mutex compile_mutex;
+  std::lock_guard<std::mutex> lock(compile_mutex);
+
   TypeDictionary types;
-  FunctionBuilder builder(thread, fn, &types);
+  FunctionBuilder builder(env, fn, &types, osr_offset, tier);
   uint8_t* function = nullptr;
 
   if (compileMethodBuilder(&builder, &function) == 0) {
@@ -23,9 +23,25 @@
 namespace wabt {
 namespace jit {
 
-using JITedFunction = interp::Result (*)();
+using JITedFunction = interp::Result (*)(interp::Thread*);
 
-JITedFunction compile(interp::Thread* thread, interp::DefinedFunc* fn);
+/**
+ * @brief Compile a function, returning nullptr on failure
+ *
+ * If osr_offset is given, the compiled function is entered at that loop header
+ * by a thread interpreting the function (on-stack replacement).
+ *
+ * Tier 1 code counts how hot it is and asks for a recompilation once
+ * Environment::jit_tier2_threshold is reached. Tier 2 code is compiled at a
+ * higher optimization level.
+ *
+ * May be called from several threads (e.g. by the background compiler), but
+ * the compilations are serialized.
+ */
+JITedFunction compile(interp::Environment* env,
+                      interp::DefinedFunc* fn,
+                      interp::IstreamOffset osr_offset = interp::kInvalidIstreamOffset,
+                      unsigned tier = 1);
 
 }
 }
@@ -185,6 +185,10 @@ bool Opcode::IsEnabled(const Features& features) const {
     case Opcode::InterpCallHost:
     case Opcode::InterpData:
     case Opcode::InterpDropKeep:
+    case Opcode::InterpGetLocalGetLocal:
+    case Opcode::InterpGetLocalGetLocalI32Add:
+    case Opcode::InterpGetLocalI32Const:
+    case Opcode::InterpGetLocalI32ConstI32Add:
       return false;
 
     default:
@@ -62,6 +62,10 @@ void OptionParser::AddArgument(const std::string& name,
   arguments_.emplace_back(name, count, callback);
 }
 
+void OptionParser::SetErrorCallback(const Callback& callback) {
+  on_error_ = callback;
+}
+
 void OptionParser::AddOption(char short_name,
                              const char* long_name,
                              const char* help,
@@ -182,8 +186,10 @@ void OptionParser::Parse(int argc, char* argv[]) {
         const Option& best_option = options_[best_index];
         const char* option_argument = nullptr;
         if (best_option.has_argument) {
-          if (arg[best_length] == '=') {
-            option_argument = &arg[best_length + 1];
+          const char* name = &arg[2];
+          size_t name_length = best_option.long_name.size();
+          if (strlen(name) > name_length && name[name_length] == '=') {
+            option_argument = &name[name_length + 1];
           } else {
             if (i + 1 == argc || argv[i + 1][0] == '-') {
               Errorf("option '--%s' requires argument",
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2017 WebAssembly Community Group participants
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include <string>
+#include <vector>
+
+#include "src/option-parser.h"
+
+using namespace wabt;
+
+namespace {
+
+struct ParseResult {
+  std::string foo;
+  bool bar = false;
+  std::vector<std::string> arguments;
+  std::vector<std::string> errors;
+};
+
+ParseResult Parse(std::vector<std::string> args) {
+  ParseResult result;
+  OptionParser parser("prog", "description");
+  parser.AddOption('f', "foo", "VALUE", "Foo",
+                   [&](const char* value) { result.foo = value; });
+  parser.AddOption("bar", "Bar", [&]() { result.bar = true; });
+  parser.AddArgument("arg", OptionParser::ArgumentCount::OneOrMore,
+                     [&](const char* value) {
+                       result.arguments.push_back(value);
+                     });
+  parser.SetErrorCallback(
+      [&](const char* message) { result.errors.push_back(message); });
+
+  // Each argument gets its own allocation, so reading past the end of one is
+  // caught by the sanitizers.
+  std::vector<std::vector<char>> storage;
+  std::vector<char*> argv;
+  args.insert(args.begin(), "prog");
+  for (const std::string& arg : args) {
+    storage.emplace_back(arg.c_str(), arg.c_str() + arg.size() + 1);
+  }
+  for (std::vector<char>& arg : storage) {
+    argv.push_back(arg.data());
+  }
+  parser.Parse(static_cast<int>(argv.size()), argv.data());
+  return result;
+}
+
+}  // end anonymous namespace
+
+TEST(option_parser, long_option_with_equals) {
+  ParseResult result = Parse({"--foo=3", "file"});
+  EXPECT_TRUE(result.errors.empty());
+  EXPECT_EQ("3", result.foo);
+  EXPECT_EQ(std::vector<std::string>{"file"}, result.arguments);
+}
+
+TEST(option_parser, long_option_with_separate_value) {
+  ParseResult result = Parse({"--foo", "3", "file"});
+  EXPECT_TRUE(result.errors.empty());
+  EXPECT_EQ("3", result.foo);
+  EXPECT_EQ(std::vector<std::string>{"file"}, result.arguments);
+}
+
+TEST(option_parser, abbreviated_long_option_with_separate_value) {
+  ParseResult result = Parse({"--fo", "3", "file"});
+  EXPECT_TRUE(result.errors.empty());
+  EXPECT_EQ("3", result.foo);
+  EXPECT_EQ(std::vector<std::string>{"file"}, result.arguments);
+}
+
+TEST(option_parser, long_option_with_empty_value) {
+  ParseResult result = Parse({"--foo=", "file"});
+  EXPECT_TRUE(result.errors.empty());
+  EXPECT_EQ("", result.foo);
+}
+
+TEST(option_parser, long_option_missing_value) {
+  ParseResult result = Parse({"file", "--foo"});
+  ASSERT_EQ(1u, result.errors.size());
+  EXPECT_EQ("option '--foo' requires argument", result.errors[0]);
+}
+
+TEST(option_parser, long_option_without_argument) {
+  ParseResult result = Parse({"--bar", "file"});
+  EXPECT_TRUE(result.errors.empty());
+  EXPECT_TRUE(result.bar);
+  EXPECT_EQ(std::vector<std::string>{"file"}, result.arguments);
+}
+
+TEST(option_parser, short_option) {
+  ParseResult result = Parse({"-f", "3", "file"});
+  EXPECT_TRUE(result.errors.empty());
+  EXPECT_EQ("3", result.foo);
+}
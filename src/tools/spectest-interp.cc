@@ -85,6 +85,10 @@ static void ParseOptions(int argc, char** argv) {
                    });
   parser.AddOption('t', "trace", "Trace execution",
                    []() { s_trace_stream = s_stdout_stream.get(); });
+  parser.AddOption("cache-top-of-stack",
+                   "Keep the top of the value stack in a register while "
+                   "interpreting",
+                   []() { s_thread_options.cache_top_of_stack = true; });
 
   parser.AddArgument("filename", OptionParser::ArgumentCount::One,
                      [](const char* argument) { s_infile = argument; });
@@ -864,7 +868,11 @@ class SpectestHostImportDelegate : public HostImportDelegate {
       memory->page_limits.has_max = true;
       memory->page_limits.initial = 1;
       memory->page_limits.max = 2;
-      memory->data.resize(memory->page_limits.initial * WABT_MAX_PAGES);
+      // The host memory is not guarded, so resizing it can't fail.
+      bool resized =
+          memory->data.resize(memory->page_limits.initial * WABT_MAX_PAGES);
+      assert(resized);
+      WABT_USE(resized);
       return wabt::Result::Ok;
     } else {
       PrintError(callback, "unknown host memory import " PRIimport,
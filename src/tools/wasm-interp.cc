@@ -16,6 +16,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
@@ -52,6 +53,12 @@ static bool s_disable_jit;
 static bool s_trap_on_failed_comp;
 static bool s_no_stack_trace;
 static uint32_t s_jit_threshold = 1;
+static uint32_t s_jit_tier2_threshold;
+static bool s_background_jit;
+static uint32_t s_osr_threshold = 1000;
+static bool s_jit_eager;
+static bool s_guard_page_memory;
+static bool s_register_istream;
 static Features s_features;
 
 static std::unique_ptr<FileStream> s_log_stream;
@@ -124,6 +131,38 @@ static void ParseOptions(int argc, char** argv) {
                      // TODO(thomasbc): validate
                      s_jit_threshold = atoi(argument.c_str());
                    });
+  parser.AddOption('\0', "jit-tier2-threshold", "THRESHOLD",
+                   "Number of calls and loop iterations of JITed code after "
+                   "which to recompile a function with more optimizations "
+                   "(0 to disable)",
+                   [](const std::string& argument) {
+                     s_jit_tier2_threshold = atoi(argument.c_str());
+                   });
+  parser.AddOption('\0', "osr-threshold", "THRESHOLD",
+                   "Number of loop iterations after which to JIT compile a "
+                   "function and enter it at the loop (0 to disable)",
+                   [](const std::string& argument) {
+                     s_osr_threshold = atoi(argument.c_str());
+                   });
+  parser.AddOption("background-jit",
+                   "JIT compile functions on a background thread, "
+                   "interpreting them until the compiled code is ready",
+                   []() { s_background_jit = true; });
+  parser.AddOption("jit-eager",
+                   "JIT compile all functions after loading the module",
+                   []() { s_jit_eager = true; });
+  parser.AddOption("guard-page-memory",
+                   "Use guard pages instead of explicit bounds checks for "
+                   "linear memory accesses",
+                   []() { s_guard_page_memory = true; });
+  parser.AddOption("register-istream",
+                   "Interpret register-style instructions, where binary "
+                   "operators access locals directly",
+                   []() { s_register_istream = true; });
+  parser.AddOption("cache-top-of-stack",
+                   "Keep the top of the value stack in a register while "
+                   "interpreting",
+                   []() { s_thread_options.cache_top_of_stack = true; });
   parser.AddOption("no-stack-trace",
                    "Don't print a stack trace if a trap occurs",
                    []() { s_no_stack_trace = true; });
@@ -256,6 +295,11 @@ static void InitEnvironment(Environment* env) {
   }
 
   env->jit_threshold = s_jit_threshold;
+  env->jit_tier2_threshold = s_jit_tier2_threshold;
+  env->background_jit = s_background_jit;
+  env->osr_threshold = s_osr_threshold;
+  env->guard_page_memory = s_guard_page_memory;
+  env->register_istream = s_register_istream;
 }
 
 static wabt::Result ReadAndRunModule(const char* module_filename) {
@@ -266,6 +310,16 @@ static wabt::Result ReadAndRunModule(const char* module_filename) {
   ErrorHandlerFile error_handler(Location::Type::Binary);
   DefinedModule* module = nullptr;
   result = ReadModule(module_filename, &env, &error_handler, &module);
+  if (Succeeded(result) && s_jit_eager) {
+    auto start = std::chrono::steady_clock::now();
+    Index count = env.JitCompileAll();
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (s_verbose) {
+      s_log_stream->Writef("compiled %" PRIindex " functions in %.3f ms\n",
+                           count, elapsed.count());
+    }
+  }
   if (Succeeded(result)) {
     Executor executor(&env, s_trace_stream, s_thread_options);
     ExecResult exec_result = executor.RunStartFunction(module);
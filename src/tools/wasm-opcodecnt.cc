@@ -37,6 +37,7 @@ static int s_verbose;
 static const char* s_infile;
 static const char* s_outfile;
 static size_t s_cutoff = 0;
+static size_t s_sequence_length = 0;
 static const char* s_separator = ": ";
 
 static ReadBinaryOptions s_read_binary_options;
@@ -49,6 +50,9 @@ R"(  Read a file in the wasm binary format, and count opcode usage for
 examples:
   # parse binary file test.wasm and write pcode dist file test.dist
   $ wasm-opcodecnt test.wasm -o test.dist
+
+  # also count the sequences of 2 or 3 consecutive opcodes
+  $ wasm-opcodecnt test.wasm --sequence-length=3
 )";
 
 static void ParseOptions(int argc, char** argv) {
@@ -69,6 +73,12 @@ static void ParseOptions(int argc, char** argv) {
   parser.AddOption(
       'c', "cutoff", "N", "Cutoff for reporting counts less than N",
       [](const std::string& argument) { s_cutoff = atol(argument.c_str()); });
+  parser.AddOption(
+      'n', "sequence-length", "N",
+      "Also count sequences of 2 to N consecutive opcodes",
+      [](const std::string& argument) {
+        s_sequence_length = atol(argument.c_str());
+      });
   parser.AddOption(
       's', "separator", "SEPARATOR",
       "Separator text between element and count when reporting counts",
@@ -142,6 +152,29 @@ void WriteCountsWithImmediates(Stream& stream,
   }
 }
 
+void WriteSequenceCounts(Stream& stream,
+                         const OpcodeSequenceCounts& counts) {
+  typedef std::pair<OpcodeSequence, size_t> OpcodeSequenceCountPair;
+
+  std::vector<OpcodeSequenceCountPair> sorted;
+  std::copy_if(counts.begin(), counts.end(), std::back_inserter(sorted),
+               WithinCutoff<OpcodeSequenceCountPair>());
+
+  // Use a stable sort to keep the sequences with the same count in opcode
+  // order (since the OpcodeSequenceCounts map is sorted).
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   SortByCountDescending<OpcodeSequenceCountPair>());
+
+  for (auto& pair : sorted) {
+    const OpcodeSequence& sequence = pair.first;
+    size_t count = pair.second;
+    for (size_t i = 0; i < sequence.size(); ++i) {
+      stream.Writef("%s%s", i == 0 ? "" : " ", sequence[i].GetName());
+    }
+    stream.Writef("%s%" PRIzd "\n", s_separator, count);
+  }
+}
+
 int ProgramMain(int argc, char** argv) {
   InitStdio();
   ParseOptions(argc, argv);
@@ -158,14 +191,22 @@ int ProgramMain(int argc, char** argv) {
 
   if (Succeeded(result)) {
     OpcodeInfoCounts counts;
-    result = ReadBinaryOpcnt(DataOrNull(file_data), file_data.size(),
-                             &s_read_binary_options, &counts);
+    OpcodeSequenceCounts sequence_counts;
+    result = ReadBinaryOpcnt(
+        DataOrNull(file_data), file_data.size(), &s_read_binary_options,
+        &counts, s_sequence_length >= 2 ? &sequence_counts : nullptr,
+        s_sequence_length);
     if (Succeeded(result)) {
       stream.Writef("Opcode counts:\n");
       WriteCounts(stream, counts);
 
       stream.Writef("\nOpcode counts with immediates:\n");
       WriteCountsWithImmediates(stream, counts);
+
+      if (s_sequence_length >= 2) {
+        stream.Writef("\nOpcode sequence counts:\n");
+        WriteSequenceCounts(stream, sequence_counts);
+      }
     }
   }
 
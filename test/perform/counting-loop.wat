@@ -0,0 +1,23 @@
+;; Sums the integers below 50000000 in a loop of locals and small operators.
+(module
+  (func (export "main") (result i32)
+    (local i32 i32)
+    i32.const 50000000
+    set_local 0
+    block
+      loop
+        get_local 0
+        i32.eqz
+        br_if 1
+        get_local 1
+        get_local 0
+        i32.add
+        set_local 1
+        get_local 0
+        i32.const -1
+        i32.add
+        set_local 0
+        br 0
+      end
+    end
+    get_local 1))
@@ -0,0 +1,39 @@
+;; Evaluates an expression tree of locals, constants and operators in a loop,
+;; so most values are intermediate results on the value stack.
+(module
+  (func (export "main") (result i32)
+    (local i32 i32 i32)
+    i32.const 20000000
+    set_local 0
+    block
+      loop
+        get_local 0
+        i32.eqz
+        br_if 1
+        ;; acc = ((acc * 31) ^ (i >> 3)) + ((i & 255) * (acc | 7))
+        get_local 1
+        i32.const 31
+        i32.mul
+        get_local 0
+        i32.const 3
+        i32.shr_u
+        i32.xor
+        get_local 0
+        i32.const 255
+        i32.and
+        get_local 1
+        i32.const 7
+        i32.or
+        i32.mul
+        i32.add
+        i32.const 1
+        i32.rotl
+        set_local 1
+        get_local 0
+        i32.const 1
+        i32.sub
+        set_local 0
+        br 0
+      end
+    end
+    get_local 1))
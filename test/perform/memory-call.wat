@@ -0,0 +1,39 @@
+;; Mixes memory accesses and calls, which work on the value stack directly,
+;; with the operators of the loop.
+(module
+  (memory 1)
+  (func $f (param i32) (result i32)
+    get_local 0
+    i32.const 1
+    i32.add)
+  (func (export "main") (result i32)
+    (local i32 i32)
+    i32.const 5000000
+    set_local 0
+    block
+      loop
+        get_local 0
+        i32.eqz
+        br_if 1
+        ;; mem[(i & 1023) * 4] = mem[...] + f(i)
+        get_local 0
+        i32.const 1023
+        i32.and
+        i32.const 2
+        i32.shl
+        tee_local 1
+        get_local 1
+        i32.load
+        get_local 0
+        call $f
+        i32.add
+        i32.store
+        get_local 0
+        i32.const 1
+        i32.sub
+        set_local 0
+        br 0
+      end
+    end
+    i32.const 400
+    i32.load))
@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+#
+# Modified from: run-jit-perform.py
+# Compares the output and execution time of the default interpreter with that
+# of a variant of it selected by command line flags, e.g. top-of-stack
+# caching. The JIT is disabled for both.
+#
+# Copyright 2016 WebAssembly Community Group participants
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+import argparse
+import difflib
+import os
+import sys
+import time
+
+import find_exe
+import utils
+from utils import Error
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def Time(tool, out_file, runs):
+  best = None
+  for _ in range(runs):
+    start = time.time()
+    out = tool.RunWithArgsForStdout(out_file)
+    elapsed = time.time() - start
+    best = elapsed if best is None else min(best, elapsed)
+  return out, best
+
+
+def main(args):
+  parser = argparse.ArgumentParser()
+  parser.add_argument('-o', '--out-dir', metavar='PATH',
+                      help='output directory for files.')
+  parser.add_argument('--bindir', metavar='PATH',
+                      default=find_exe.GetDefaultPath(),
+                      help='directory to search for all executables.')
+  parser.add_argument('--no-error-cmdline',
+                      help='don\'t display the subprocess\'s commandline when'
+                      + ' an error occurs', dest='error_cmdline',
+                      action='store_false')
+  parser.add_argument('-p', '--print-cmd',
+                      help='print the commands that are run.',
+                      action='store_true')
+  parser.add_argument('--variant', metavar='FLAGS',
+                      default='--cache-top-of-stack',
+                      help='wasm-interp flags selecting the variant to '
+                      'compare with the default interpreter.')
+  parser.add_argument('--runs', type=int, default=5,
+                      help='number of runs of each interpreter; the fastest '
+                      'one is reported.')
+  parser.add_argument('file', help='test file.')
+  options = parser.parse_args(args)
+
+  wast_tool = utils.Executable(
+      find_exe.GetWat2WasmExecutable(options.bindir),
+      error_cmdline=options.error_cmdline)
+  interp_tool = utils.Executable(
+      find_exe.GetWasmInterpExecutable(options.bindir),
+      '--disable-jit', '--run-all-exports',
+      error_cmdline=options.error_cmdline)
+  variant_tool = utils.Executable(
+      find_exe.GetWasmInterpExecutable(options.bindir),
+      '--disable-jit', '--run-all-exports', *options.variant.split(),
+      error_cmdline=options.error_cmdline)
+
+  wast_tool.verbose = options.print_cmd
+  interp_tool.verbose = options.print_cmd
+  variant_tool.verbose = options.print_cmd
+
+  with utils.TempDirectory(options.out_dir, 'run-interp-perform-') as out_dir:
+    if not options.file.endswith('.wasm'):
+      out_file = utils.ChangeDir(
+          utils.ChangeExt(options.file, '.wasm'), out_dir)
+      wast_tool.RunWithArgs(options.file, '-o', out_file)
+    else:
+      out_file = options.file
+    interp_out, interp_time = Time(interp_tool, out_file, options.runs)
+    variant_out, variant_time = Time(variant_tool, out_file, options.runs)
+    print('Interpreter: {}\n{}: {}'.format(interp_time, options.variant,
+                                           variant_time))
+    expected_lines = [line for line in interp_out.splitlines() if line]
+    actual_lines = [line for line in variant_out.splitlines() if line]
+    diff_lines = list(
+        difflib.unified_diff(expected_lines, actual_lines, fromfile='expected',
+                             tofile='actual', lineterm=''))
+    if diff_lines:
+      raise Error('STDOUT MISMATCH:\n' + '\n'.join(diff_lines) + '\n')
+
+  return 0
+
+
+if __name__ == '__main__':
+  try:
+    sys.exit(main(sys.argv[1:]))
+  except Error as e:
+    sys.stderr.write(str(e) + '\n')
+    sys.exit(1)
@@ -52,6 +52,12 @@ def main(args):
   parser.add_argument('--enable-threads', action='store_true')
   parser.add_argument('--disable-jit', action='store_true')
   parser.add_argument('--trap-on-failed-comp', action='store_true')
+  parser.add_argument('--guard-page-memory', action='store_true')
+  parser.add_argument('--background-jit', action='store_true')
+  parser.add_argument('--jit-eager', action='store_true')
+  parser.add_argument('--jit-tier2-threshold', type=int)
+  parser.add_argument('--register-istream', action='store_true')
+  parser.add_argument('--cache-top-of-stack', action='store_true')
   options = parser.parse_args(args)
 
   wast_tool = None
@@ -91,6 +97,12 @@ def main(args):
           options.enable_saturating_float_to_int,
       '--enable-threads': options.enable_threads,
       '--disable-jit': options.disable_jit,
+      '--guard-page-memory': options.guard_page_memory,
+      '--background-jit': options.background_jit,
+      '--jit-eager': options.jit_eager,
+      '--jit-tier2-threshold': options.jit_tier2_threshold,
+      '--register-istream': options.register_istream,
+      '--cache-top-of-stack': options.cache_top_of_stack,
       '--no-stack-trace': not options.spec
   })
 
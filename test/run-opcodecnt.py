@@ -43,6 +43,7 @@ def main(args):
   parser.add_argument('--print-cmd', help='print the commands that are run.',
                       action='store_true')
   parser.add_argument('-c', '--cutoff', type=int, default=0)
+  parser.add_argument('-n', '--sequence-length', type=int, default=0)
   parser.add_argument('file', help='test file.')
   options = parser.parse_args(args)
 
@@ -63,7 +64,8 @@ def main(args):
   with utils.TempDirectory(options.out_dir, 'run-opcodecnt-') as out_dir:
     out_file = utils.ChangeDir(utils.ChangeExt(options.file, '.wasm'), out_dir)
     wat2wasm.RunWithArgs(options.file, '-o', out_file)
-    wasm_opcodecnt.RunWithArgs(out_file, '-c', str(options.cutoff))
+    wasm_opcodecnt.RunWithArgs(out_file, '-c', str(options.cutoff),
+                               '-n', str(options.sequence_length))
 
   return 0
 